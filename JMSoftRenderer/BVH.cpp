@@ -0,0 +1,337 @@
+#include "header/BVH.h"
+
+#include <omp.h>
+#include <algorithm>
+
+struct BVH::Split {
+	AABB bounds;			// of the node's triangles
+	int axis = -1;			// -1 for a leaf
+	int bin = -1;			// triangles with a centroid bin below it go left, -1 to split at the median
+	float binMin = 0, binScale = 0;
+};
+
+namespace {
+	const int STACK_SIZE = 256;			// traversal needs one entry more than the tree depth
+	// deeper nodes split at the median, which halves a 32 bit triangle count within the remaining levels
+	const int MEDIAN_DEPTH = STACK_SIZE - 1 - 32;
+	const float EDGE_TOLERANCE = 1e-5f;	// in barycentric coordinates
+
+	inline float Area(const AABB& box) {
+		Vector3 d = box.max - box.min;
+		return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+	}
+
+	inline void Merge(AABB& box, const AABB& other) {
+		if (other.isEmpty()) return;
+		box.expand(other.min);
+		box.expand(other.max);
+	}
+
+	inline int BinIndex(float centroid, float binMin, float binScale) {
+		return MIN((int)((centroid - binMin) * binScale), BVH::BINS - 1);
+	}
+
+	inline __m128 Select(__m128 mask, __m128 a, __m128 b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+
+	// lanes whose ray enters the box before tmax
+	inline int HitBox(const BVH::Node& node, const __m128* origin, const __m128* inverseDir, __m128 tmax) {
+		__m128 tnear = _mm_setzero_ps(), tfar = tmax;
+		for (int a = 0; a < 3; a++) {
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[a]), origin[a]), inverseDir[a]);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[a]), origin[a]), inverseDir[a]);
+			tnear = _mm_max_ps(tnear, _mm_min_ps(t0, t1));
+			tfar = _mm_min_ps(tfar, _mm_max_ps(t0, t1));
+		}
+		return _mm_movemask_ps(_mm_cmple_ps(tnear, tfar));
+	}
+
+	// Moller-Trumbore against one triangle, returns the mask of lanes hitting it before tmax
+	inline __m128 HitTriangle(const Vector3& v0, const Vector3& e1, const Vector3& e2, const __m128* origin, const __m128* dir,
+		__m128 tmax, __m128& t, __m128& u, __m128& v) {
+		__m128 e1x = _mm_set1_ps(e1.x), e1y = _mm_set1_ps(e1.y), e1z = _mm_set1_ps(e1.z);
+		__m128 e2x = _mm_set1_ps(e2.x), e2y = _mm_set1_ps(e2.y), e2z = _mm_set1_ps(e2.z);
+		__m128 px = _mm_sub_ps(_mm_mul_ps(dir[1], e2z), _mm_mul_ps(dir[2], e2y));
+		__m128 py = _mm_sub_ps(_mm_mul_ps(dir[2], e2x), _mm_mul_ps(dir[0], e2z));
+		__m128 pz = _mm_sub_ps(_mm_mul_ps(dir[0], e2y), _mm_mul_ps(dir[1], e2x));
+		__m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+		__m128 inverseDet = _mm_div_ps(_mm_set1_ps(1.0f), det);
+
+		__m128 tx = _mm_sub_ps(origin[0], _mm_set1_ps(v0.x));
+		__m128 ty = _mm_sub_ps(origin[1], _mm_set1_ps(v0.y));
+		__m128 tz = _mm_sub_ps(origin[2], _mm_set1_ps(v0.z));
+		u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverseDet);
+
+		__m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+		__m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+		__m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+		v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dir[0], qx), _mm_mul_ps(dir[1], qy)), _mm_mul_ps(dir[2], qz)), inverseDet);
+		t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverseDet);
+
+		// a small tolerance on the edges keeps rays from slipping between neighboring triangles,
+		// comparisons with the NaNs of a zero determinant are false
+		__m128 zero = _mm_setzero_ps(), low = _mm_set1_ps(-EDGE_TOLERANCE);
+		__m128 mask = _mm_and_ps(_mm_cmpge_ps(u, low), _mm_cmpge_ps(v, low));
+		mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f + EDGE_TOLERANCE)));
+		mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, tmax)));
+		return _mm_and_ps(mask, _mm_cmpneq_ps(det, zero));
+	}
+
+	inline void LoadRays(const RayPacket& packet, __m128* origin, __m128* dir, __m128* inverseDir) {
+		origin[0] = _mm_load_ps(packet.ox), origin[1] = _mm_load_ps(packet.oy), origin[2] = _mm_load_ps(packet.oz);
+		dir[0] = _mm_load_ps(packet.dx), dir[1] = _mm_load_ps(packet.dy), dir[2] = _mm_load_ps(packet.dz);
+		for (int a = 0; a < 3; a++) inverseDir[a] = _mm_div_ps(_mm_set1_ps(1.0f), dir[a]);
+	}
+}
+
+BVH::Split BVH::findSplit(const vector<AABB>& bounds, const vector<Vector3>& centroids, const unsigned int* order, unsigned int count, bool parallel) {
+	struct Bin { AABB box; unsigned int count = 0; };
+	int threads = parallel ? omp_get_max_threads() : 1;
+	Split split;
+
+	// bounds of the triangles and of their centroids
+	vector<AABB> boxes(threads), centroidBoxes(threads);
+#pragma omp parallel for schedule(static) if (parallel)
+	for (int i = 0; i < (int)count; i++) {
+		int thread = omp_get_thread_num();
+		Merge(boxes[thread], bounds[order[i]]);
+		centroidBoxes[thread].expand(centroids[order[i]]);
+	}
+	AABB centroidBox;
+	for (int i = 0; i < threads; i++) {
+		Merge(split.bounds, boxes[i]);
+		Merge(centroidBox, centroidBoxes[i]);
+	}
+	if (count <= MAX_LEAF) return split;
+
+	// bin the centroids along every axis
+	float binScale[3];
+	for (int a = 0; a < 3; a++) {
+		float extent = centroidBox.max[a] - centroidBox.min[a];
+		binScale[a] = extent > 0 ? BINS * (1 - 1e-4f) / extent : 0;
+	}
+	vector<Bin> bins(threads * 3 * BINS);
+#pragma omp parallel for schedule(static) if (parallel)
+	for (int i = 0; i < (int)count; i++) {
+		Bin* threadBins = &bins[omp_get_thread_num() * 3 * BINS];
+		const AABB& box = bounds[order[i]];
+		for (int a = 0; a < 3; a++) {
+			if (binScale[a] == 0) continue;
+			Bin& bin = threadBins[a * BINS + BinIndex(centroids[order[i]][a], centroidBox.min[a], binScale[a])];
+			Merge(bin.box, box);
+			bin.count++;
+		}
+	}
+	for (int t = 1; t < threads; t++)
+		for (int i = 0; i < 3 * BINS; i++) {
+			Merge(bins[i].box, bins[t * 3 * BINS + i].box);
+			bins[i].count += bins[t * 3 * BINS + i].count;
+		}
+
+	// Sweep the bin boundaries for the lowest SAH cost, with traversal and intersection costing
+	// the same: 1 + (area(left) * left + area(right) * right) / area(node), against count for a leaf.
+	float best = Math::Infinity;
+	for (int a = 0; a < 3; a++) {
+		if (binScale[a] == 0) continue;
+		const Bin* axisBins = &bins[a * BINS];
+		float rightCost[BINS];
+		AABB right;
+		unsigned int rightCount = 0;
+		for (int i = BINS - 1; i > 0; i--) {
+			Merge(right, axisBins[i].box);
+			rightCount += axisBins[i].count;
+			rightCost[i] = rightCount ? Area(right) * rightCount : 0;
+		}
+		AABB left;
+		unsigned int leftCount = 0;
+		for (int i = 1; i < BINS; i++) {
+			Merge(left, axisBins[i - 1].box);
+			leftCount += axisBins[i - 1].count;
+			if (leftCount == 0 || leftCount == count) continue;
+			float cost = Area(left) * leftCount + rightCost[i];
+			if (cost < best) {
+				best = cost;
+				split.axis = a;
+				split.bin = i;
+				split.binMin = centroidBox.min[a];
+				split.binScale = binScale[a];
+			}
+		}
+	}
+
+	// leaf when splitting doesn't pay off, unless it would be large
+	float leafCost = (float)count, area = Area(split.bounds);
+	bool binned = split.axis >= 0;
+	if (count <= 64 && (!binned || area <= 0 || 1 + best / area >= leafCost)) {
+		split.axis = -1;
+		return split;
+	}
+	if (!binned) {// all centroids coincide
+		Vector3 extent = split.bounds.extent();
+		split.axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+		split.bin = -1;
+	}
+	return split;
+}
+
+void BVH::build(const vector<Vector3>& vertices) {
+	unsigned int count = (unsigned int)(vertices.size() / 3);
+	nodes.clear();
+	triangles.clear();
+	ids.clear();
+	maxDepth = 0;
+	if (count == 0) return;
+
+	vector<AABB> bounds(count);
+	vector<Vector3> centroids(count);
+	vector<unsigned int> order(count);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)count; i++) {
+		for (int k = 0; k < 3; k++) bounds[i].expand(vertices[i * 3 + k]);
+		centroids[i] = bounds[i].center();
+		order[i] = i;
+	}
+
+	// split every node of a level, then allocate their children in order
+	struct Task { unsigned int node, begin, end; };
+	vector<Task> tasks = { { 0, 0, count } }, next;
+	vector<Split> splits;
+	vector<unsigned int> middles;
+	nodes.resize(1);
+	int threads = omp_get_max_threads();
+	for (int depth = 0; !tasks.empty(); depth++) {
+		maxDepth = depth;
+		splits.resize(tasks.size());
+		middles.resize(tasks.size());
+		auto process = [&](int i, bool parallel) {
+			const Task& task = tasks[i];
+			Split& split = splits[i] = findSplit(bounds, centroids, &order[task.begin], task.end - task.begin, parallel);
+			if (split.axis < 0) return;
+			if (depth >= MEDIAN_DEPTH) split.bin = -1;
+			unsigned int* first = &order[task.begin], * last = &order[0] + task.end;
+			int axis = split.axis;
+			if (split.bin >= 0)
+				middles[i] = (unsigned int)(std::partition(first, last, [&](unsigned int t) {
+					return BinIndex(centroids[t][axis], split.binMin, split.binScale) < split.bin;
+				}) - &order[0]);
+			else {
+				unsigned int* middle = first + (last - first) / 2;
+				std::nth_element(first, middle, last, [&](unsigned int a, unsigned int b) { return centroids[a][axis] < centroids[b][axis]; });
+				middles[i] = (unsigned int)(middle - &order[0]);
+			}
+		};
+		if ((int)tasks.size() >= threads) {
+#pragma omp parallel for schedule(dynamic)
+			for (int i = 0; i < (int)tasks.size(); i++) process(i, false);
+		}
+		else
+			for (int i = 0; i < (int)tasks.size(); i++) process(i, true);
+
+		next.clear();
+		for (size_t i = 0; i < tasks.size(); i++) {
+			const Task& task = tasks[i];
+			const Split& split = splits[i];
+			unsigned int children = (unsigned int)nodes.size();
+			if (split.axis >= 0) nodes.resize(children + 2);
+			Node& node = nodes[task.node];
+			for (int a = 0; a < 3; a++) node.min[a] = split.bounds.min[a], node.max[a] = split.bounds.max[a];
+			if (split.axis < 0) {
+				node.index = task.begin;
+				node.count = (unsigned short)(task.end - task.begin);
+				node.axis = 0;
+				continue;
+			}
+			node.index = children;
+			node.count = 0;
+			node.axis = (unsigned short)split.axis;
+			next.push_back({ children, task.begin, middles[i] });
+			next.push_back({ children + 1, middles[i], task.end });
+		}
+		tasks.swap(next);
+	}
+
+	triangles.resize(count);
+	ids = std::move(order);
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < (int)count; i++) {
+		const Vector3* v = &vertices[ids[i] * 3];
+		triangles[i] = { v[0], v[1] - v[0], v[2] - v[0] };
+	}
+}
+
+void BVH::intersect(RayPacket& packet) const {
+	if (nodes.empty()) return;
+	__m128 origin[3], dir[3], inverseDir[3];
+	LoadRays(packet, origin, dir, inverseDir);
+	__m128 tmax = _mm_load_ps(packet.tmax), u = _mm_load_ps(packet.u), v = _mm_load_ps(packet.v);
+	__m128i id = _mm_load_si128((const __m128i*)packet.id);
+	// near child first, by the summed direction of the packet
+	bool negative[3] = {
+		packet.dx[0] + packet.dx[1] + packet.dx[2] + packet.dx[3] < 0,
+		packet.dy[0] + packet.dy[1] + packet.dy[2] + packet.dy[3] < 0,
+		packet.dz[0] + packet.dz[1] + packet.dz[2] + packet.dz[3] < 0 };
+
+	unsigned int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (!HitBox(node, origin, inverseDir, tmax)) continue;
+		if (node.count) {
+			for (unsigned int i = node.index; i < node.index + node.count; i++) {
+				const Triangle& triangle = triangles[i];
+				__m128 t, hitU, hitV;
+				__m128 mask = HitTriangle(triangle.v0, triangle.e1, triangle.e2, origin, dir, tmax, t, hitU, hitV);
+				if (!_mm_movemask_ps(mask)) continue;
+				tmax = Select(mask, t, tmax);
+				u = Select(mask, hitU, u);
+				v = Select(mask, hitV, v);
+				__m128i maskI = _mm_castps_si128(mask);
+				id = _mm_or_si128(_mm_and_si128(maskI, _mm_set1_epi32((int)ids[i])), _mm_andnot_si128(maskI, id));
+			}
+			continue;
+		}
+		bool flip = negative[node.axis];
+		assert(top + 2 <= STACK_SIZE);
+		stack[top++] = node.index + (flip ? 0 : 1);
+		stack[top++] = node.index + (flip ? 1 : 0);
+	}
+
+	_mm_store_ps(packet.tmax, tmax);
+	_mm_store_ps(packet.u, u);
+	_mm_store_ps(packet.v, v);
+	_mm_store_si128((__m128i*)packet.id, id);
+}
+
+int BVH::occluded(const RayPacket& packet) const {
+	if (nodes.empty()) return 0;
+	__m128 origin[3], dir[3], inverseDir[3];
+	LoadRays(packet, origin, dir, inverseDir);
+	__m128 tmax = _mm_load_ps(packet.tmax);
+	int active = _mm_movemask_ps(_mm_cmpgt_ps(tmax, _mm_setzero_ps())), blocked = 0;
+
+	unsigned int stack[STACK_SIZE];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		const Node& node = nodes[stack[--top]];
+		if (!HitBox(node, origin, inverseDir, tmax)) continue;
+		if (node.count) {
+			for (unsigned int i = node.index; i < node.index + node.count; i++) {
+				const Triangle& triangle = triangles[i];
+				__m128 t, u, v;
+				__m128 mask = HitTriangle(triangle.v0, triangle.e1, triangle.e2, origin, dir, tmax, t, u, v);
+				int hits = _mm_movemask_ps(mask);
+				if (!hits) continue;
+				// blocked rays are done, any hit will do
+				blocked |= hits;
+				if (blocked == active) return blocked;
+				tmax = Select(mask, _mm_set1_ps(-1.0f), tmax);
+			}
+			continue;
+		}
+		assert(top + 2 <= STACK_SIZE);
+		stack[top++] = node.index;
+		stack[top++] = node.index + 1;
+	}
+	return blocked;
+}
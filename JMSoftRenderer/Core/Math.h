@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cmath>
+#include <xmmintrin.h>
 
 namespace Math {
 	const static float Infinity = std::numeric_limits<float>::infinity();
@@ -144,6 +145,17 @@ namespace Math {
 		return x;
 	}
 
+	// 1 / sqrt(x), the SSE estimate refined by one Newton step (about 22 bits), x > 0
+	inline float rsqrt(float x) {
+		float y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+		return y * (1.5f - 0.5f * x * y * y);
+	}
+
+	// sqrt(x) as x * rsqrt(x), 0 stays 0
+	inline float fastSqrt(float x) {
+		return x * rsqrt(_max(x, 1e-30f));
+	}
+
 	template <class T>
 	bool solveQuadratic(const T a, const T b, const T c, T& x0, T& x1) {
 		T discr = b * b - 4 * a * c;
@@ -44,6 +44,14 @@ public:
 		return *this;
 	}
 
+	bool operator == (const Matrix& v) const {
+		for (uint8_t i = 0; i < 4; ++i)
+			for (uint8_t j = 0; j < 4; ++j)
+				if (x[i][j] != v.x[i][j]) return false;
+		return true;
+	}
+	bool operator != (const Matrix& v) const { return !(*this == v); }
+
 	// To make it easier to understand how a matrix multiplication works, the fragment of code
 	// included within the #if-#else statement, show how this works if you were to iterate
 	// over the coefficients of the resulting matrix (a). However you will often see this
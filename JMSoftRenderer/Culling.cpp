@@ -0,0 +1,95 @@
+#include "header/Culling.h"
+
+void BuildMeshlets(MeshBuffers& buffers) {
+	const vector<Vector3>& p = buffers.positions;
+	const vector<unsigned int>& indices = buffers.indices;
+	size_t triangleCount = indices.size() / 3;
+	vector<Meshlet>& meshlets = buffers.meshlets;
+	meshlets.clear();
+	meshlets.reserve((triangleCount + MESHLET_TRIANGLES - 1) / MESHLET_TRIANGLES);
+
+	Vector3 normals[MESHLET_TRIANGLES];
+	for (size_t first = 0; first < triangleCount; first += MESHLET_TRIANGLES) {
+		Meshlet meshlet;
+		meshlet.firstIndex = (unsigned int)(first * 3);
+		meshlet.triangleCount = (unsigned int)MIN((size_t)MESHLET_TRIANGLES, triangleCount - first);
+		const unsigned int* index = &indices[meshlet.firstIndex];
+		size_t indexCount = meshlet.triangleCount * 3;
+
+		// bounding sphere around the center of the box
+		AABB bounds;
+		for (size_t i = 0; i < indexCount; i++) bounds.expand(p[index[i]]);
+		meshlet.sphere.center = bounds.center();
+		meshlet.sphere.radius = 0;
+		for (size_t i = 0; i < indexCount; i++)
+			meshlet.sphere.radius = MAX(meshlet.sphere.radius, (p[index[i]] - meshlet.sphere.center).length());
+
+		// normal cone: average face normal and the widest angle to it
+		Vector3 axis;
+		bool degenerate = false;
+		for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+			const unsigned int* tri = index + t * 3;
+			normals[t] = cross(p[tri[1]] - p[tri[0]], p[tri[2]] - p[tri[0]]);
+			float area = normals[t].length();
+			if (area <= 0) { degenerate = true; continue; }
+			normals[t] *= 1.0f / area;
+			axis += normals[t];
+		}
+		float axisLength = axis.length();
+		float minDot = 1;
+		if (axisLength > 0) {
+			axis *= 1.0f / axisLength;
+			for (unsigned int t = 0; t < meshlet.triangleCount; t++)
+				if (normals[t].lengthSqr() > 0) minDot = MIN(minDot, normals[t].dot(axis));
+		}
+		meshlet.coneAxis = axis;
+		// cones wider than ~84 degrees (or with degenerate triangles) never cull
+		meshlet.coneCutoff = degenerate || axisLength <= 0 || minDot <= 0.1f ? 1.0f : sqrt(1 - minDot * minDot);
+		meshlets.push_back(meshlet);
+	}
+}
+
+Frustum::Frustum(const Matrix& mvp) {
+	// clip = p * mvp, column j of mvp gives clip component j
+	auto column = [&](int j) { return Plane{ Vector3(mvp[0][j], mvp[1][j], mvp[2][j]), mvp[3][j] }; };
+	auto add = [](const Plane& a, const Plane& b, float sign) { return Plane{ a.n + b.n * sign, a.d + b.d * sign }; };
+	Plane x = column(0), y = column(1), z = column(2), w = column(3);
+	planes[0] = add(w, x, 1);	// -w <= x
+	planes[1] = add(w, x, -1);	// x <= w
+	planes[2] = add(w, y, 1);	// -w <= y
+	planes[3] = add(w, y, -1);	// y <= w
+	planes[4] = z;				// 0 <= z
+	planes[5] = add(w, z, -1);	// z <= w
+	for (auto& plane : planes) {
+		float length = plane.n.length();
+		if (length > 0) {
+			plane.n *= 1.0f / length;
+			plane.d /= length;
+		}
+	}
+}
+
+CullResult Frustum::test(const BoundingSphere& sphere) const {
+	CullResult result = Inside;
+	for (auto& plane : planes) {
+		float d = plane.distance(sphere.center);
+		if (d < -sphere.radius) return Outside;
+		if (d < sphere.radius) result = Intersect;
+	}
+	return result;
+}
+
+ViewOrigin::ViewOrigin(const Matrix& modelView, const Matrix& projection) {
+	// perspective projections copy view z into w
+	orthographic = projection[2][3] == 0;
+	Matrix inv = Matrix(modelView).inverse();
+	eye = inv.apply(Vector3(0, 0, 0));
+	dir = inv.applyDir(Vector3(0, 0, 1)).normalize();
+}
+
+bool ViewOrigin::isBackfacing(const Meshlet& meshlet) const {
+	if (meshlet.coneCutoff >= 1) return false;
+	if (orthographic) return dir.dot(meshlet.coneAxis) >= meshlet.coneCutoff;
+	Vector3 toCenter = meshlet.sphere.center - eye;
+	return toCenter.dot(meshlet.coneAxis) >= meshlet.coneCutoff * toCenter.length() + meshlet.sphere.radius;
+}
@@ -0,0 +1,129 @@
+#include "header/DepthRasterizer.h"
+
+#include <xmmintrin.h>
+
+namespace {
+	const int DEPTH_TILE_SIZE = 32;
+}
+
+void DepthRasterizer::begin(int width, int height) {
+	this->width = width;
+	this->height = height;
+	tilesX = (width + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+	tilesY = (height + DEPTH_TILE_SIZE - 1) / DEPTH_TILE_SIZE;
+	queues.resize(omp_get_max_threads());
+	for (auto& queue : queues) {
+		queue.triangles.clear();
+		queue.bins.resize(tilesX * tilesY);
+		for (auto& bin : queue.bins) bin.clear();
+	}
+}
+
+void DepthRasterizer::addTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2) {
+	float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+	if (area <= 0) return;
+
+	DepthTriangle tri;
+	const Vector3* v[3] = { &v0, &v1, &v2 };
+	for (int k = 0; k < 3; k++) {
+		tri.x[k] = v[k]->x;
+		tri.y[k] = v[k]->y;
+	}
+	// pixels whose centers lie inside the bounds; most distant triangles cover none
+	tri.minX = MAX((int)ceil(MIN(v0.x, MIN(v1.x, v2.x)) - 0.5f), 0);
+	tri.minY = MAX((int)ceil(MIN(v0.y, MIN(v1.y, v2.y)) - 0.5f), 0);
+	tri.maxX = MIN((int)floor(MAX(v0.x, MAX(v1.x, v2.x)) - 0.5f), width - 1);
+	tri.maxY = MIN((int)floor(MAX(v0.y, MAX(v1.y, v2.y)) - 0.5f), height - 1);
+	if (tri.minX > tri.maxX || tri.minY > tri.maxY) return;
+
+	// z is affine in screen space for the orthographic light projection
+	float invArea = 1.0f / area;
+	tri.z0 = v0.z;
+	tri.dzdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+	tri.dzdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * invArea;
+
+	ThreadQueue& queue = queues[omp_get_thread_num()];
+	unsigned int index = (unsigned int)queue.triangles.size();
+	queue.triangles.push_back(tri);
+	for (int ty = tri.minY / DEPTH_TILE_SIZE; ty <= tri.maxY / DEPTH_TILE_SIZE; ty++)
+		for (int tx = tri.minX / DEPTH_TILE_SIZE; tx <= tri.maxX / DEPTH_TILE_SIZE; tx++)
+			queue.bins[ty * tilesX + tx].push_back(index);
+}
+
+void DepthRasterizer::flush(FloatBuffer& target) {
+	assert((int)target.get_width() == width && (int)target.get_height() == height);
+
+	// every tile is owned by a single thread
+#pragma omp parallel for schedule(dynamic)
+	for (int tile = 0; tile < tilesX * tilesY; tile++) {
+		int tileX0 = (tile % tilesX) * DEPTH_TILE_SIZE, tileY0 = (tile / tilesX) * DEPTH_TILE_SIZE;
+		int tileX1 = MIN(tileX0 + DEPTH_TILE_SIZE, width) - 1, tileY1 = MIN(tileY0 + DEPTH_TILE_SIZE, height) - 1;
+		for (auto& queue : queues)
+			for (unsigned int index : queue.bins[tile])
+				rasterizeTriangle(target, queue.triangles[index], tileX0, tileY0, tileX1, tileY1);
+	}
+
+	for (auto& queue : queues) {
+		queue.triangles.clear();
+		for (auto& bin : queue.bins) bin.clear();
+	}
+}
+
+void DepthRasterizer::rasterizeTriangle(FloatBuffer& target, const DepthTriangle& tri, int tileX0, int tileY0, int tileX1, int tileY1) {
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	const __m128 zero = _mm_setzero_ps();
+	int x0 = MAX(tri.minX, tileX0), x1 = MIN(tri.maxX, tileX1);
+	int y0 = MAX(tri.minY, tileY0), y1 = MIN(tri.maxY, tileY1);
+	if (x0 > x1 || y0 > y1) return;
+
+	// edge functions and z at the centers of pixels x0..x0+3 on row y0
+	float ea[3], eb[3], rowStart[3];
+	for (int k = 0; k < 3; k++) {
+		int n = (k + 1) % 3;
+		ea[k] = tri.y[k] - tri.y[n];
+		eb[k] = tri.x[n] - tri.x[k];
+		float ec = tri.x[k] * tri.y[n] - tri.y[k] * tri.x[n];
+		rowStart[k] = ea[k] * x0 + eb[k] * (y0 + 0.5f) + ec;
+	}
+	float zRowStart = tri.z0 + tri.dzdx * (x0 - tri.x[0]) + tri.dzdy * (y0 + 0.5f - tri.y[0]);
+
+	__m128 e[3], eStep[3], eRowStep[3];
+	for (int k = 0; k < 3; k++) {
+		e[k] = _mm_add_ps(_mm_set1_ps(rowStart[k]), _mm_mul_ps(_mm_set1_ps(ea[k]), offsets));
+		eStep[k] = _mm_set1_ps(ea[k] * 4);
+		eRowStep[k] = _mm_set1_ps(eb[k]);
+	}
+	__m128 z = _mm_add_ps(_mm_set1_ps(zRowStart), _mm_mul_ps(_mm_set1_ps(tri.dzdx), offsets));
+	__m128 zStep = _mm_set1_ps(tri.dzdx * 4), zRowStep = _mm_set1_ps(tri.dzdy);
+
+	for (int y = y0; y <= y1; y++) {
+		float* row = target(0, y);
+		__m128 e0 = e[0], e1 = e[1], e2 = e[2], zx = z;
+		int x = x0;
+		for (; x + 3 <= x1; x += 4) {
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+			if (_mm_movemask_ps(inside)) {
+				__m128 d = _mm_loadu_ps(row + x);
+				__m128 nearer = _mm_and_ps(inside, _mm_cmplt_ps(zx, d));
+				_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(nearer, zx), _mm_andnot_ps(nearer, d)));
+			}
+			e0 = _mm_add_ps(e0, eStep[0]);
+			e1 = _mm_add_ps(e1, eStep[1]);
+			e2 = _mm_add_ps(e2, eStep[2]);
+			zx = _mm_add_ps(zx, zStep);
+		}
+		// remaining pixels at the right edge of the tile
+		if (x <= x1) {
+			float ev[3][4], zv[4];
+			_mm_storeu_ps(ev[0], e0);
+			_mm_storeu_ps(ev[1], e1);
+			_mm_storeu_ps(ev[2], e2);
+			_mm_storeu_ps(zv, zx);
+			for (int i = 0; x + i <= x1; i++)
+				if (ev[0][i] >= 0 && ev[1][i] >= 0 && ev[2][i] >= 0 && zv[i] < row[x + i])
+					row[x + i] = zv[i];
+		}
+		for (int k = 0; k < 3; k++) e[k] = _mm_add_ps(e[k], eRowStep[k]);
+		z = _mm_add_ps(z, zRowStep);
+	}
+}
@@ -0,0 +1,77 @@
+#include "header/DirtyTiles.h"
+
+#include <algorithm>
+
+void DirtyTiles::begin(int width, int height) {
+	if (width != this->width || height != this->height) {
+		this->width = width;
+		this->height = height;
+		tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		tiles.assign(tilesX * tilesY, 1);
+		valid = false;
+	}
+	items.clear();
+}
+
+void DirtyTiles::mark(const Rect& rect) {
+	if (rect.isEmpty()) return;
+	for (int ty = rect.y0 / TILE_SIZE; ty <= rect.y1 / TILE_SIZE; ty++)
+		for (int tx = rect.x0 / TILE_SIZE; tx <= rect.x1 / TILE_SIZE; tx++)
+			tiles[ty * tilesX + tx] = 1;
+}
+
+void DirtyTiles::finish() {
+	all = !valid || items.size() != previousItems.size();
+	std::fill(tiles.begin(), tiles.end(), all ? 1 : 0);
+	if (!all) {
+		for (size_t i = 0; i < items.size(); i++)
+			if (items[i].hash != previousItems[i].hash) {
+				mark(previousItems[i].rect);
+				mark(items[i].rect);
+			}
+		all = std::find(tiles.begin(), tiles.end(), 0) == tiles.end();
+	}
+	clean = std::find(tiles.begin(), tiles.end(), 1) == tiles.end();
+	std::swap(items, previousItems);
+	valid = true;
+}
+
+void DirtyTiles::select(const int* indices, size_t count) {
+	std::fill(tiles.begin(), tiles.end(), 0);
+	for (size_t i = 0; i < count; i++) tiles[indices[i]] = 1;
+	all = count == tiles.size();
+	clean = count == 0;
+}
+
+bool DirtyTiles::touches(const Rect& rect) const {
+	if (rect.isEmpty()) return false;
+	if (all) return true;
+	for (int ty = rect.y0 / TILE_SIZE; ty <= rect.y1 / TILE_SIZE; ty++)
+		for (int tx = rect.x0 / TILE_SIZE; tx <= rect.x1 / TILE_SIZE; tx++)
+			if (tiles[ty * tilesX + tx]) return true;
+	return false;
+}
+
+DirtyTiles::Rect DirtyTiles::projectSphere(const Vector3& center, float radius, const Matrix& viewProjection, const Vector3& sweep) const {
+	// project the corners of the sphere's bounding box at both ends of the sweep,
+	// the swept box projects inside their hull as long as all of them are in front of the camera
+	float minX = Math::Infinity, minY = Math::Infinity, maxX = -Math::Infinity, maxY = -Math::Infinity;
+	for (int i = 0; i < 16; i++) {
+		Vector3 corner = center + Vector3(i & 1 ? radius : -radius, i & 2 ? radius : -radius, i & 4 ? radius : -radius);
+		if (i & 8) corner += sweep;
+		Vector4 clipPos;
+		viewProjection.apply(corner, clipPos);
+		if (clipPos.w <= 1e-5f) return fullScreen();
+		float x = (clipPos.x / clipPos.w + 1.0f) * width * 0.5f, y = (1.0f - clipPos.y / clipPos.w) * height * 0.5f;
+		minX = MIN(minX, x), maxX = MAX(maxX, x);
+		minY = MIN(minY, y), maxY = MAX(maxY, y);
+	}
+	// one pixel of margin for the rounding of the rasterizer
+	Rect rect;
+	rect.x0 = (int)Math::clamp(floor(minX) - 1, 0.0f, (float)width);
+	rect.y0 = (int)Math::clamp(floor(minY) - 1, 0.0f, (float)height);
+	rect.x1 = (int)Math::clamp(ceil(maxX) + 1, -1.0f, (float)(width - 1));
+	rect.y1 = (int)Math::clamp(ceil(maxY) + 1, -1.0f, (float)(height - 1));
+	return rect;
+}
@@ -0,0 +1,300 @@
+#include "header/Environment.h"
+
+#include "include\stb_image.h"
+
+namespace {
+	const int SPECULAR_SAMPLES = 64;
+	const int BRDF_SAMPLES = 256;
+	const int BRDF_LUT_SIZE = 64;
+	const size_t MIN_SPECULAR_SIZE = 4;
+
+	// van der Corput radical inverse
+	inline Vector2 Hammersley(unsigned int i, unsigned int count) {
+		unsigned int bits = i;
+		bits = (bits << 16u) | (bits >> 16u);
+		bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+		bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+		bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+		bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+		return Vector2((float)i / count, bits * 2.3283064365386963e-10f);
+	}
+
+	// GGX half vector around n for a sample xi, alpha = roughness^2
+	inline Vector3 ImportanceSampleGGX(const Vector2& xi, float alpha, const Vector3& n) {
+		float phi = 2.0f * Math::PI * xi.x;
+		float cosTheta = sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+		float sinTheta = sqrt(1.0f - cosTheta * cosTheta);
+		Vector3 h(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);
+
+		Vector3 up = fabs(n.z) < 0.999f ? Vector3(0, 0, 1) : Vector3(1, 0, 0);
+		Vector3 tangentX = cross(up, n).normalize();
+		Vector3 tangentY = cross(n, tangentX);
+		return tangentX * h.x + tangentY * h.y + n * h.z;
+	}
+
+	inline float D_GGX(float alpha, float NoH) {
+		float a2 = alpha * alpha;
+		float d = NoH * NoH * (a2 - 1.0f) + 1.0f;
+		return a2 / (Math::PI * d * d);
+	}
+
+	// same visibility term as Shader::PhysicallyBasedShading
+	inline float V_SmithGGXCorrelated(float alpha, float NoV, float NoL) {
+		float a2 = alpha * alpha;
+		float GGXV = NoL * sqrt((NoV - a2 * NoV) * NoV + a2);
+		float GGXL = NoV * sqrt((NoL - a2 * NoL) * NoL + a2);
+		return 0.5f / (GGXV + GGXL);
+	}
+
+	// bilinear sample of an equirectangular image, y up, -z at the horizontal center
+	RGBColor SampleEquirect(const ColorBuffer& image, const Vector3& dir) {
+		float u = atan2(dir.x, -dir.z) * (0.5f * Math::INV_PI) + 0.5f;
+		float v = acos(Math::clamp(dir.y, -1.0f, 1.0f)) * Math::INV_PI;
+		int width = (int)image.get_width(), height = (int)image.get_height();
+		float x = u * width - 0.5f, y = Math::clamp(v * height - 0.5f, 0.0f, height - 1.0f);
+		int x0 = (int)floor(x), y0 = (int)y;
+		float fx = x - x0, fy = y - y0;
+		int y1 = MIN(y0 + 1, height - 1);
+		x0 = (x0 % width + width) % width;
+		int x1 = (x0 + 1) % width;
+		const RGBColor* row0 = image(0, y0), * row1 = image(0, y1);
+		RGBColor top = Math::lerp(row0[x0], row0[x1], fx);
+		RGBColor bottom = Math::lerp(row1[x0], row1[x1], fx);
+		return Math::lerp(top, bottom, fy);
+	}
+
+	// mip chain of a cube map by 2x2 box filtering
+	vector<CubeMap> DownsampleChain(const CubeMap& base) {
+		vector<CubeMap> chain;
+		chain.push_back(base);
+		while (chain.back().size() > 1) {
+			const CubeMap& src = chain.back();
+			CubeMap dst(src.size() / 2);
+			for (int f = 0; f < 6; f++) {
+				const ColorBuffer& s = *src.faces[f];
+				ColorBuffer& d = *dst.faces[f];
+				for (size_t y = 0; y < d.get_height(); y++)
+					for (size_t x = 0; x < d.get_width(); x++)
+						d.set(x, y, (s.get(2 * x, 2 * y) + s.get(2 * x + 1, 2 * y) +
+							s.get(2 * x, 2 * y + 1) + s.get(2 * x + 1, 2 * y + 1)) * 0.25f);
+			}
+			chain.push_back(dst);
+		}
+		return chain;
+	}
+
+	// sample a mip chain at a fractional level
+	RGBColor SampleChain(const vector<CubeMap>& chain, const Vector3& dir, float level) {
+		level = Math::clamp(level, 0.0f, chain.size() - 1.0f);
+		size_t l0 = (size_t)level, l1 = MIN(l0 + 1, chain.size() - 1);
+		return Math::lerp(chain[l0].sample(dir), chain[l1].sample(dir), level - l0);
+	}
+
+	// real SH basis up to band 2
+	inline void SHBasis(const Vector3& d, float* y) {
+		y[0] = 0.282095f;
+		y[1] = 0.488603f * d.y;
+		y[2] = 0.488603f * d.z;
+		y[3] = 0.488603f * d.x;
+		y[4] = 1.092548f * d.x * d.y;
+		y[5] = 1.092548f * d.y * d.z;
+		y[6] = 0.315392f * (3.0f * d.z * d.z - 1.0f);
+		y[7] = 1.092548f * d.x * d.z;
+		y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+	}
+
+	// integrate the GGX specular lobe with F0 factored out: F0 * x + y
+	void BakeSplitSumBRDF(FrameBuffer<Vector2>& table) {
+#pragma omp parallel for schedule(dynamic)
+		for (int y = 0; y < BRDF_LUT_SIZE; y++) {
+			float roughness = (y + 0.5f) / BRDF_LUT_SIZE, alpha = roughness * roughness;
+			for (int x = 0; x < BRDF_LUT_SIZE; x++) {
+				float NoV = (x + 0.5f) / BRDF_LUT_SIZE;
+				Vector3 V(sqrt(1.0f - NoV * NoV), 0, NoV), N(0, 0, 1);
+				float a = 0, b = 0;
+				for (unsigned int i = 0; i < BRDF_SAMPLES; i++) {
+					Vector3 H = ImportanceSampleGGX(Hammersley(i, BRDF_SAMPLES), alpha, N);
+					Vector3 L = H * (2.0f * V.dot(H)) - V;
+					float NoL = Math::clamp(L.z), NoH = Math::clamp(H.z), VoH = Math::clamp(V.dot(H));
+					if (NoL <= 0) continue;
+					// pdf = D * NoH / (4 * VoH), so the sample weight reduces to the visibility term
+					float visibility = V_SmithGGXCorrelated(alpha, NoV, NoL) * 4.0f * NoL * VoH / NoH;
+					float fc = Math::pow5(1.0f - VoH);
+					a += (1.0f - fc) * visibility;
+					b += fc * visibility;
+				}
+				table.set(x, y, Vector2(a / BRDF_SAMPLES, b / BRDF_SAMPLES));
+			}
+		}
+	}
+}
+
+Vector3 CubeMap::direction(int face, float u, float v) {
+	switch (face) {
+	case 0: return Vector3(1, -v, -u);
+	case 1: return Vector3(-1, -v, u);
+	case 2: return Vector3(u, 1, v);
+	case 3: return Vector3(u, -1, -v);
+	case 4: return Vector3(u, -v, 1);
+	default: return Vector3(-u, -v, -1);
+	}
+}
+
+RGBColor CubeMap::sample(const Vector3& dir) const {
+	float ax = fabs(dir.x), ay = fabs(dir.y), az = fabs(dir.z);
+	if (!(ax + ay + az > 0)) return RGBColor();	// zero or NaN direction
+	int face;
+	float u, v;
+	if (ax >= ay && ax >= az) {
+		face = dir.x > 0 ? 0 : 1;
+		u = (dir.x > 0 ? -dir.z : dir.z) / ax;
+		v = -dir.y / ax;
+	}
+	else if (ay >= az) {
+		face = dir.y > 0 ? 2 : 3;
+		u = dir.x / ay;
+		v = (dir.y > 0 ? dir.z : -dir.z) / ay;
+	}
+	else {
+		face = dir.z > 0 ? 4 : 5;
+		u = (dir.z > 0 ? dir.x : -dir.x) / az;
+		v = -dir.y / az;
+	}
+
+	const ColorBuffer& map = *faces[face];
+	int size = (int)map.get_width();
+	float x = Math::clamp((u + 1.0f) * 0.5f * size - 0.5f, 0.0f, size - 1.0f);
+	float y = Math::clamp((v + 1.0f) * 0.5f * size - 0.5f, 0.0f, size - 1.0f);
+	int x0 = (int)x, y0 = (int)y, x1 = MIN(x0 + 1, size - 1), y1 = MIN(y0 + 1, size - 1);
+	float fx = x - x0, fy = y - y0;
+	const RGBColor* row0 = map(0, y0), * row1 = map(0, y1);
+	RGBColor top = Math::lerp(row0[x0], row0[x1], fx);
+	RGBColor bottom = Math::lerp(row1[x0], row1[x1], fx);
+	return Math::lerp(top, bottom, fy);
+}
+
+RGBColor Environment::irradiance(const Vector3& n) const {
+	float y[9];
+	SHBasis(n, y);
+	RGBColor e;
+	for (int i = 0; i < 9; i++) e += irradianceSH[i] * y[i];
+	return RGBColor(MAX(e.r, 0.0f), MAX(e.g, 0.0f), MAX(e.b, 0.0f));
+}
+
+RGBColor Environment::radiance(const Vector3& r, float roughness) const {
+	return SampleChain(specular, r, roughness * (specular.size() - 1));
+}
+
+RGBColor Environment::shade(const RGBColor& baseColor, float roughness, float metallic, const Vector3& N, const Vector3& V) const {
+	float NoV = Math::clamp(N.dot(V), 1e-4f, 1.0f);
+	Vector3 R = N * (2.0f * N.dot(V)) - V;
+
+	const FrameBuffer<Vector2>& lut = SplitSumBRDF();
+	size_t lx = MIN((size_t)(NoV * BRDF_LUT_SIZE), (size_t)BRDF_LUT_SIZE - 1);
+	size_t ly = MIN((size_t)(roughness * BRDF_LUT_SIZE), (size_t)BRDF_LUT_SIZE - 1);
+	Vector2 brdf = lut.get(lx, ly);
+
+	RGBColor diffuseColor = baseColor * (1.0f - metallic);
+	RGBColor f0 = baseColor * metallic + RGBColor(0.04f * (1.0f - metallic));
+	RGBColor specularColor = f0 * brdf.x + RGBColor(brdf.y);
+
+	return (diffuseColor * irradiance(N) * Math::INV_PI + specularColor * radiance(R, roughness)) * intensity;
+}
+
+const FrameBuffer<Vector2>& SplitSumBRDF() {
+	static FrameBuffer<Vector2> lut(BRDF_LUT_SIZE, BRDF_LUT_SIZE);
+	[[maybe_unused]] static bool baked = (BakeSplitSumBRDF(lut), true);
+	return lut;
+}
+
+shared_ptr<Environment> LoadEnvironment(const char* filename, size_t specularSize) {
+	int width, height, comp;
+	float* data = stbi_loadf(filename, &width, &height, &comp, STBI_rgb);
+	if (!data) return nullptr;
+	ColorBuffer image(width, height);
+	for (int i = 0; i < width * height; i++)
+		image.set(i, RGBColor(data[3 * i], data[3 * i + 1], data[3 * i + 2]));
+	stbi_image_free(data);
+
+	auto environment = make_shared<Environment>();
+
+	// irradiance: project the radiance onto SH weighted by texel solid angle, then convolve
+	// with the clamped cosine lobe (pi, 2pi/3, pi/4 per band)
+	vector<RGBColor> rowSH((size_t)height * 9);
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		float theta = (y + 0.5f) * Math::PI / height;
+		float solidAngle = (2.0f * Math::PI / width) * (Math::PI / height) * sin(theta);
+		for (int x = 0; x < width; x++) {
+			float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * Math::PI;
+			Vector3 dir(sin(theta) * sin(phi), cos(theta), -sin(theta) * cos(phi));
+			float basis[9];
+			SHBasis(dir, basis);
+			RGBColor radiance = image(0, y)[x] * solidAngle;
+			for (int i = 0; i < 9; i++) rowSH[(size_t)y * 9 + i] += radiance * basis[i];
+		}
+	}
+	const float band[9] = { Math::PI, 2.0f * Math::PI / 3, 2.0f * Math::PI / 3, 2.0f * Math::PI / 3,
+		Math::PI / 4, Math::PI / 4, Math::PI / 4, Math::PI / 4, Math::PI / 4 };
+	for (int i = 0; i < 9; i++) {
+		RGBColor sum;
+		for (int y = 0; y < height; y++) sum += rowSH[(size_t)y * 9 + i];
+		environment->irradianceSH[i] = sum * band[i];
+	}
+
+	// radiance cube map, 4x4 supersampled from the equirectangular image, and its box mip chain
+	CubeMap base(specularSize);
+	for (int f = 0; f < 6; f++) {
+		ColorBuffer& face = *base.faces[f];
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < (int)specularSize; y++)
+			for (size_t x = 0; x < specularSize; x++) {
+				RGBColor sum;
+				for (int s = 0; s < 16; s++) {
+					float u = (x + ((s & 3) + 0.5f) * 0.25f) / specularSize * 2.0f - 1.0f;
+					float v = (y + ((s >> 2) + 0.5f) * 0.25f) / specularSize * 2.0f - 1.0f;
+					sum += SampleEquirect(image, CubeMap::direction(f, u, v).normalize());
+				}
+				face.set(x, y, sum * (1.0f / 16));
+			}
+	}
+	vector<CubeMap> source = DownsampleChain(base);
+
+	// specular: GGX prefiltered mips assuming N = V = R, sampling the source mip matching
+	// each sample's solid angle to avoid noise (filtered importance sampling)
+	size_t levels = 1;
+	while ((specularSize >> levels) >= MIN_SPECULAR_SIZE) levels++;
+	environment->specular.push_back(base);
+	float texelSolidAngle = 4.0f * Math::PI / (6.0f * specularSize * specularSize);
+	for (size_t level = 1; level < levels; level++) {
+		float roughness = (float)level / (levels - 1), alpha = roughness * roughness;
+		size_t size = specularSize >> level;
+		CubeMap map(size);
+		for (int f = 0; f < 6; f++) {
+			ColorBuffer& face = *map.faces[f];
+#pragma omp parallel for schedule(dynamic)
+			for (int y = 0; y < (int)size; y++)
+				for (size_t x = 0; x < size; x++) {
+					Vector3 N = CubeMap::direction(f, (x + 0.5f) / size * 2.0f - 1.0f, (y + 0.5f) / size * 2.0f - 1.0f).normalize();
+					RGBColor sum;
+					float weight = 0;
+					for (unsigned int i = 0; i < SPECULAR_SAMPLES; i++) {
+						Vector3 H = ImportanceSampleGGX(Hammersley(i, SPECULAR_SAMPLES), alpha, N);
+						float NoH = Math::clamp(N.dot(H));
+						Vector3 L = H * (2.0f * NoH) - N;
+						float NoL = N.dot(L);
+						if (NoL <= 0) continue;
+						float pdf = D_GGX(alpha, NoH) * 0.25f;
+						float sampleSolidAngle = 1.0f / (SPECULAR_SAMPLES * pdf + 1e-4f);
+						float mip = 0.5f * log2(sampleSolidAngle / texelSolidAngle) + 1.0f;
+						sum += SampleChain(source, L, mip) * NoL;
+						weight += NoL;
+					}
+					face.set(x, y, weight > 0 ? sum / weight : RGBColor());
+				}
+		}
+		environment->specular.push_back(map);
+	}
+	SplitSumBRDF();
+	return environment;
+}
@@ -0,0 +1,83 @@
+#include "header/LightClusters.h"
+
+namespace {
+	struct ClusterRange {
+		int x0, y0, s0, x1, y1, s1;	// inclusive, x0 > x1 if the light reaches no cluster
+	};
+}
+
+void LightClusters::build(const vector<PunctualLight>& lights, const Matrix& view, const Matrix& projection, int width, int height) {
+	assert(lights.size() <= 0xFFFF);
+	this->width = width;
+	this->height = height;
+	tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+	// view depth of the near and far planes
+	Matrix invProjection = Matrix(projection).inverse();
+	zNear = invProjection.apply(Vector3(0, 0, 0)).z;
+	zFar = invProjection.apply(Vector3(0, 0, 1)).z;
+	float logNear = MAX(zNear, 1e-3f);	// orthographic cameras may start at 0
+	sliceScale = SLICES / log(zFar / logNear);
+	sliceBias = -log(logNear) * sliceScale;
+	auto sliceOf = [&](float viewDepth) {
+		return viewDepth <= logNear ? 0 : Math::clamp((int)(log(viewDepth) * sliceScale + sliceBias), 0, SLICES - 1);
+	};
+
+	int clusterCount = tilesX * tilesY * SLICES;
+	offsets.assign(clusterCount + 1, 0);
+	indices.clear();
+
+	// clusters touched by the screen rectangle and depth range of each light's bounding sphere
+	vector<ClusterRange> ranges(lights.size());
+	for (size_t i = 0; i < lights.size(); i++) {
+		ClusterRange& range = ranges[i];
+		range = { 0, 0, 0, -1, -1, -1 };
+		Vector3 center;
+		float radius;
+		lights[i].bounds(center, radius);
+		Vector3 c = view.apply(center);
+		if (c.z + radius <= zNear || c.z - radius >= zFar) continue;
+
+		float minX = 0, minY = 0, maxX = (float)width, maxY = (float)height;
+		if (c.z - radius > logNear) {
+			// the sphere is in front of the camera: project its bounding box
+			minX = minY = Math::Infinity;
+			maxX = maxY = -Math::Infinity;
+			for (int k = 0; k < 8; k++) {
+				Vector3 corner(c.x + (k & 1 ? radius : -radius), c.y + (k & 2 ? radius : -radius), c.z + (k & 4 ? radius : -radius));
+				Vector3 ndc = projection.apply(corner);
+				float px = (ndc.x + 1.0f) * width * 0.5f, py = (1.0f - ndc.y) * height * 0.5f;
+				minX = MIN(minX, px);
+				maxX = MAX(maxX, px);
+				minY = MIN(minY, py);
+				maxY = MAX(maxY, py);
+			}
+			if (maxX < 0 || maxY < 0 || minX >= width || minY >= height) continue;
+		}
+		range.x0 = Math::clamp((int)MAX(minX, 0.0f) / TILE_SIZE, 0, tilesX - 1);
+		range.y0 = Math::clamp((int)MAX(minY, 0.0f) / TILE_SIZE, 0, tilesY - 1);
+		range.x1 = Math::clamp((int)MIN(maxX, (float)width - 1) / TILE_SIZE, 0, tilesX - 1);
+		range.y1 = Math::clamp((int)MIN(maxY, (float)height - 1) / TILE_SIZE, 0, tilesY - 1);
+		range.s0 = sliceOf(c.z - radius);
+		range.s1 = sliceOf(c.z + radius);
+	}
+
+	// count, prefix sum, then fill in light order so every list is sorted
+	for (auto& range : ranges)
+		for (int s = range.s0; s <= range.s1; s++)
+			for (int y = range.y0; y <= range.y1; y++)
+				for (int x = range.x0; x <= range.x1; x++)
+					offsets[clusterIndex(x, y, s) + 1]++;
+	for (int i = 0; i < clusterCount; i++) offsets[i + 1] += offsets[i];
+	indices.resize(offsets[clusterCount]);
+
+	vector<unsigned int> cursor(offsets.begin(), offsets.end() - 1);
+	for (size_t i = 0; i < ranges.size(); i++) {
+		const ClusterRange& range = ranges[i];
+		for (int s = range.s0; s <= range.s1; s++)
+			for (int y = range.y0; y <= range.y1; y++)
+				for (int x = range.x0; x <= range.x1; x++)
+					indices[cursor[clusterIndex(x, y, s)]++] = (unsigned short)i;
+	}
+}
@@ -1,45 +1,149 @@
 #include "header/Window.h"
 #include "header/Pipeline.h"
-#include "header/OBJ_Loader.h"
+#include "header/MeshCache.h"
+
+#include <chrono>
+#include <cstring>
+#include <random>
 
 using namespace std;
 
-void addMesh(Scene& scene, vector<objl::Mesh> objMeshes, shared_ptr<IntBuffer> texture = nullptr, RGBColor color = Colors::White) {
-	for (auto& objMesh : objMeshes)
+void addMesh(Scene& scene, vector<Mesh>&& meshes, RGBColor color = Colors::White) {
+	for (auto& mesh : meshes)
 	{
-		Mesh mesh;
-		for (size_t i = 0; i < objMesh.Vertices.size(); i++)
-		{
-			auto objVert = objMesh.Vertices[i];
-			Vertex v;
-			v.point = Vector3(objVert.Position.X, objVert.Position.Y, objVert.Position.Z);
-			v.normal = Vector3(objVert.Normal.X, objVert.Normal.Y, objVert.Normal.Z);
-			v.texCoord = Vector2(objVert.TextureCoordinate.X, objVert.TextureCoordinate.Y);
-			v.color = RGBColor(objVert.TextureCoordinate.X, objVert.TextureCoordinate.Y, 1.0f);
-			mesh.vertices.push_back(v);
-		}
-		mesh.indices = objMesh.Indices;
-		mesh.texture = MipMap(texture);
 		mesh.color = color;
-		scene.addMesh(mesh);
+		scene.addMesh(std::move(mesh));
 	}
+	meshes.clear();
 }
 
+// meshescount x countʵ,  models/rock/rock.obj
+void addInstanceGrid(Scene& scene, vector<Mesh>&& meshes, int count, float spacing, float scale) {
+	vector<Instance> instances;
+	for (int i = 0; i < count; i++)
+		for (int j = 0; j < count; j++) {
+			Instance instance;
+			float x = (i - (count - 1) * 0.5f) * spacing, z = (j - (count - 1) * 0.5f) * spacing;
+			instance.model.scale(scale, scale, scale)
+				.rotate(0, 1, 0, (float)((i * 37 + j * 91) % 360))
+				.translate(x, 0, z);
+			instance.color = RGBColor(0.7f + 0.3f * i / count, 0.7f + 0.3f * j / count, 0.8f);
+			instances.push_back(instance);
+		}
+	for (auto& mesh : meshes)
+		scene.addInstances(std::move(mesh), instances);
+	meshes.clear();
+}
 
-int	main(void) {
+// Ӱ˷ʽȾ̶֡, ӰPassɫPassƽʱ(ms)
+// ڼرӰ, ʹÿ֡ػӰȲؽVSM/ESMľͼ
+void benchmarkShadowFilters(Pipeline& pipeline, Scene& scene, int frames = 30) {
+	const pair<ShadowFilter, const char*> filters[] = {
+		{ ShadowFilter::Hard, "Hard" }, { ShadowFilter::PCF, "PCF" }, { ShadowFilter::PCSS, "PCSS" },
+		{ ShadowFilter::VSM, "VSM" }, { ShadowFilter::ESM, "ESM" }
+	};
+	typedef chrono::high_resolution_clock Clock;
+	auto elapsed = [](Clock::time_point start) { return chrono::duration<double, milli>(Clock::now() - start).count(); };
+
+	pipeline.enableShadow = true;
+	bool shadowCache = pipeline.enableShadowCache;
+	pipeline.enableShadowCache = false;
+	printf("shadow cache off, shadow maps re-rendered every frame\n");
+	for (auto& filter : filters) {
+		pipeline.shadowFilter.filter = filter.first;
+		double shadowTime = 0, shadingTime = 0;
+		for (int i = -2; i < frames; i++) {// ǰ֡Ԥ
+			pipeline.clearBuffers(Colors::Black);
+			auto start = Clock::now();
+			pipeline.renderShadowMap(scene);
+			double shadow = elapsed(start);
+			start = Clock::now();
+			pipeline.renderMeshes(scene);
+			if (i >= 0) {
+				shadowTime += shadow;
+				shadingTime += elapsed(start);
+			}
+		}
+		printf("%-5s shadow pass %7.2f ms  shading pass %7.2f ms\n", filter.second, shadowTime / frames, shadingTime / frames);
+	}
+	pipeline.enableShadowCache = shadowCache;
+}
+
+// image(Ⱦһ֡)ظFXAA, ÿ֡ÿصƽʱ(ms)
+void benchmarkFXAA(const IntBuffer& image, int runs = 50) {
+	typedef chrono::high_resolution_clock Clock;
+	IntBuffer target(image.get_width(), image.get_height());
+	FXAA fxaa;
+	double time = 0;
+	for (int i = -2; i < runs; i++) {// ǰԤ
+		memcpy(target(), image(), image.get_size() * sizeof(int));
+		auto start = Clock::now();
+		fxaa.apply(target);
+		if (i >= 0) time += chrono::duration<double, milli>(Clock::now() - start).count();
+	}
+	double megapixels = image.get_size() * 1e-6;
+	printf("FXAA  %7.2f ms  %7.2f ms/MP\n", time / runs, time / runs / megapixels);
+}
+
+// ķ/Դ//ʱȽϿBRDFοʵ, , ݲfalse
+bool validateShadingQuality(int samples = 200000) {
+	const pair<ShadingQuality, const char*> qualities[] = { { ShadingQuality::FastMath, "FastMath" }, { ShadingQuality::FastLUT, "FastLUT" } };
+	const float tolerance[] = { 2e-3f, 2e-2f };
+
+	mt19937 rng(1);
+	uniform_real_distribution<float> uniform(0.0f, 1.0f);
+	auto randomDirection = [&](const Vector3& n) {
+		// nڰڵ
+		Vector3 d;
+		do d = Vector3(uniform(rng), uniform(rng), uniform(rng)) * 2.0f - Vectors::one_v3; while (d.lengthSqr() > 1.0f || d.lengthSqr() < 1e-4f);
+		d.normalize();
+		return d.dot(n) < 0 ? -d : d;
+	};
+
+	bool passed = true;
+	for (int q = 0; q < 2; q++) {
+		VisibilityLUT lut;
+		float maxError = 0;
+		for (int i = 0; i < samples; i++) {
+			// LUTֲڶȹ, ÿ1000һδֲڶ
+			if (i % 1000 == 0) lut.build(0.05f + 0.95f * uniform(rng));
+			float metallic = uniform(rng);
+			Vector3 n = randomDirection(Vector3(0, 0, 1)), l = randomDirection(n), v = randomDirection(n);
+			float NoL = n.dot(l);
+			RGBColor base(uniform(rng), uniform(rng), uniform(rng)), reference = base, fast = base;
+			Shader::PhysicallyBasedShading(reference, lut.roughness, metallic, n, l, v, NoL);
+			Shader::PhysicallyBasedShadingFast(fast, lut.roughness, metallic, n, l, v, NoL,
+				qualities[q].first == ShadingQuality::FastLUT ? &lut : nullptr);
+			// NoLȽ(ʵķ), 1e-3Ϊ
+			float error = MAX(fabs(reference.r - fast.r), MAX(fabs(reference.g - fast.g), fabs(reference.b - fast.b))) * NoL
+				/ MAX(MAX(reference.r, MAX(reference.g, reference.b)) * NoL, 1e-3f);
+			maxError = MAX(maxError, error);
+		}
+		bool ok = maxError <= tolerance[q];
+		printf("%-8s max relative error %.2e (tolerance %.0e) %s\n", qualities[q].second, maxError, tolerance[q], ok ? "ok" : "FAILED");
+		passed &= ok;
+	}
+	return passed;
+}
+
+
+int	main(int argc, char** argv) {
+
+	// -validate: ֻBRDFԲοʵֵ
+	if (argc > 1 && strcmp(argv[1], "-validate") == 0)
+		return validateShadingQuality() ? 0 : 1;
 
 	IntBuffer colorBuffer(1280, 720);
 	Pipeline pipeline(colorBuffer, 512, ProjectionMethod::Perspective, false);
-	Window window(colorBuffer.get_width(), colorBuffer.get_height(), _T("JM Soft Renderer  "));
+	pipeline.setShadowCascades({ 1024, 512, 512 });
 
 	// Load .obj File
-	objl::Loader loader;
+	vector<Mesh> meshes;
 	const char* texture_path = "../../../../models/spot/checkerboard.png";
 	//const char* texture_path = "../../../../models/spot/spot_texture.png";
 	//const char* obj_path = "../../../../models/spot/_spot_triangulated_good.obj";
 	const char* obj_path = "../../../../models/spot/sphere.obj";
-	auto tex = CreateTexture(texture_path);
-	if (!loader.LoadFile(obj_path)) {
+	if (!LoadMeshCached(obj_path, meshes, texture_path, 4)) {
 		cout << "File loading failed!" << endl;
 		return 1;
 	}
@@ -55,9 +159,24 @@ int	main(void) {
 	scene.setPerspective(60.0f, colorBuffer.get_aspect(), 0.1f, 100.0f);
 
 
-	addMesh(scene, loader.LoadedMeshes, tex);
-	//addMesh(scene, loader.LoadedMeshes, NULL, RGBColor(0.5f));
+	//for (auto& mesh : meshes) mesh.shader = MakeShader(UnlitShader());	// Զɫ, ShaderProgram.h
+	//for (auto& mesh : meshes) mesh.blendMode = AlphaBlend, mesh.opacity = 0.5f;	// ͸
+	addMesh(scene, std::move(meshes));
+	//addMesh(scene, std::move(meshes), RGBColor(0.5f));
+	//addInstanceGrid(scene, std::move(meshes), 32, 0.5f, 0.1f);
+	//scene.addPointLight(Vector3(0.8f, 0.2f, -0.5f), 2.0f, 1.0f, RGBColor(1.0f, 0.4f, 0.2f));
+	//scene.setEnvironment(LoadEnvironment("../../../../models/hdr/environment.hdr"), 0.5f);
+	//scene.addSpotLight(Vector3(0, 1.5f, 0), Vector3(0, -1, 0), 3.0f, 15.0f, 25.0f, 4.0f, Colors::White);
+
+	// -bench: , ֻȽϸӰ˷ʽFXAAĺʱ
+	if (argc > 1 && strcmp(argv[1], "-bench") == 0) {
+		benchmarkShadowFilters(pipeline, scene);
+		benchmarkFXAA(colorBuffer);
+		return 0;
+	}
 
+	Window window(colorBuffer.get_width(), colorBuffer.get_height(), _T("JM Soft Renderer  "));
+	const char* toneMappingNames[] = { "Clamp", "Reinhard", "ACES" };
 
 	while (window.is_run())
 	{
@@ -71,7 +190,15 @@ int	main(void) {
 		window.title = (std::ostringstream() <<
 			"Roughness:" << pipeline.roughness << 
 			"  Metallic:" << pipeline.metallic <<
-			"  MipmapLevelOffset:" << pipeline.mipmapLevelOffset
+			"  MipmapLevelOffset:" << pipeline.mipmapLevelOffset <<
+			"  MSAA:" << pipeline.msaaSamples << "x" <<
+			"  FXAA:" << (pipeline.enableFXAA ? "On" : "Off") <<
+			"  ToneMapping:" << toneMappingNames[pipeline.toneMapper.mapping] <<
+			"  Incremental:" << (pipeline.enableIncremental ? "On" : "Off") <<
+			"  Temporal:" << (pipeline.enableTemporal ? "On" : "Off") <<
+			"  VRS:" << (pipeline.enableVRS ? "On" : "Off") <<
+			"  Progressive:" << (pipeline.enableProgressive ? "On" : "Off") <<
+			"  RayTracing:" << (pipeline.enableRayTracing ? "On" : "Off")
 			).str();
 		window.update();
 
@@ -84,7 +211,8 @@ int	main(void) {
 
 		if (window.is_key('A')) scene.modelRotate(2.0f);
 		else if (window.is_key('D')) scene.modelRotate(-2.0f);
-		else scene.modelRotate(0.25f);
+		else if (!pipeline.enableIncremental && !pipeline.enableProgressive && !pipeline.enableRayTracing)
+			scene.modelRotate(0.25f);	// /ʽȾʱֹͣԶת, ֹĻ治ػϸ; ׷ʱÿ֡ؽBVH
 
 		if (window.is_key(VK_LEFT)) pipeline.roughness -= 0.01f;
 		if (window.is_key(VK_RIGHT)) pipeline.roughness += 0.01f;
@@ -92,6 +220,26 @@ int	main(void) {
 		if (window.is_key(VK_DOWN)) pipeline.metallic -= 0.01f;
 		if (window.is_key('Z')) pipeline.mipmapLevelOffset--;
 		if (window.is_key('X')) pipeline.mipmapLevelOffset++;
+		for (int samples : { 1, 2, 4, 8 })// ּлMSAA
+			if (window.is_key('0' + samples)) pipeline.msaaSamples = samples;
+		if (window.is_key('F')) pipeline.enableFXAA = true;
+		if (window.is_key('G')) pipeline.enableFXAA = false;
+		// C: Խض(Gamma), V: Reinhard, B: ACES, ߰ʾGamma 2.2
+		if (window.is_key('C')) pipeline.toneMapper.mapping = LinearClamp, pipeline.toneMapper.gamma = 1.0f;
+		if (window.is_key('V')) pipeline.toneMapper.mapping = Reinhard, pipeline.toneMapper.gamma = 2.2f;
+		if (window.is_key('B')) pipeline.toneMapper.mapping = ACESFilmic, pipeline.toneMapper.gamma = 2.2f;
+		if (window.is_key('O')) pipeline.transparencyMode = WeightedOIT;
+		if (window.is_key('P')) pipeline.transparencyMode = SortedBlend;
+		if (window.is_key('I')) pipeline.enableIncremental = true;
+		if (window.is_key('U')) pipeline.enableIncremental = false;
+		if (window.is_key('T')) pipeline.enableTemporal = true;	// ֱȾ + ʱϲ
+		if (window.is_key('Y')) pipeline.enableTemporal = false;
+		if (window.is_key('K')) pipeline.enableVRS = true;
+		if (window.is_key('L')) pipeline.enableVRS = false;
+		if (window.is_key('N')) pipeline.enableProgressive = true;	// ƶʱ1/4Ԥ, ͣºϸ
+		if (window.is_key('M')) pipeline.enableProgressive = false;
+		if (window.is_key('R')) pipeline.enableRayTracing = true;	// ͬһĹ׷ٲοͼ(ӰAO󽻵õ)
+		if (window.is_key('H')) pipeline.enableRayTracing = false;
 		pipeline.roughness = Math::clamp(pipeline.roughness);
 		pipeline.metallic = Math::clamp(pipeline.metallic);
 	}
@@ -0,0 +1,293 @@
+#include "header/MeshCache.h"
+#include "header/MeshLoader.h"
+#include "header/MappedFile.h"
+#include "header/Simplify.h"
+
+#include <cstring>
+#include <fstream>
+#include <filesystem>
+
+namespace {
+
+	const char CACHE_MAGIC[4] = { 'J', 'M', 'C', '1' };
+	const uint32_t CACHE_VERSION = 3;
+	const uint64_t CACHE_ALIGNMENT = 16;
+
+	static_assert(sizeof(Vector3) == 3 * sizeof(float), "Vector3 must be tightly packed");
+	static_assert(sizeof(TexCoord) == 2 * sizeof(float), "TexCoord must be tightly packed");
+	static_assert(sizeof(Meshlet) == 10 * sizeof(float), "Meshlet must be tightly packed");
+
+	// size and modification time of the files the cache was built from
+	struct SourceStamp {
+		uint64_t objSize = 0;
+		int64_t objTime = 0;
+		uint64_t textureSize = 0;
+		int64_t textureTime = 0;
+	};
+
+	struct CacheHeader {
+		char magic[4];
+		uint32_t version;
+		SourceStamp source;
+		uint32_t meshCount;
+		uint32_t mipCount;
+		uint32_t lodLevels;
+	};
+
+	// byte offsets are relative to the start of the file
+	struct CacheMesh {
+		uint64_t vertexCount, indexCount, meshletCount;
+		uint64_t positions, normals, texCoords, indices, meshlets;
+		float boundsMin[3], boundsMax[3];
+		float sphere[4];
+		uint32_t lodLevel;	// 0 for a mesh, otherwise a LOD of the closest preceding mesh
+		float lodError;
+	};
+
+	struct CacheMip {
+		uint32_t width, height;
+		uint64_t offset;
+	};
+
+	inline uint64_t alignUp(uint64_t offset) {
+		return (offset + CACHE_ALIGNMENT - 1) & ~(CACHE_ALIGNMENT - 1);
+	}
+
+	void stampFile(const char* path, uint64_t& size, int64_t& time) {
+		std::error_code ec;
+		size = std::filesystem::file_size(path, ec);
+		if (ec) size = 0;
+		auto t = std::filesystem::last_write_time(path, ec);
+		time = ec ? 0 : (int64_t)t.time_since_epoch().count();
+	}
+
+	SourceStamp stampSources(const char* objPath, const char* texturePath) {
+		SourceStamp stamp;
+		stampFile(objPath, stamp.objSize, stamp.objTime);
+		if (texturePath) stampFile(texturePath, stamp.textureSize, stamp.textureTime);
+		return stamp;
+	}
+
+	bool sameSource(const SourceStamp& a, const SourceStamp& b) {
+		return a.objSize == b.objSize && a.objTime == b.objTime &&
+			a.textureSize == b.textureSize && a.textureTime == b.textureTime;
+	}
+
+	class CacheWriter {
+	private:
+		std::ofstream file;
+		uint64_t offset = 0;
+
+	public:
+		CacheWriter(const string& path) : file(path, std::ios::binary | std::ios::trunc) {}
+
+		inline bool isOpen() const { return file.is_open(); }
+		inline bool good() const { return file.good(); }
+		inline uint64_t tell() const { return offset; }
+
+		void write(const void* data, uint64_t bytes) {
+			file.write((const char*)data, bytes);
+			offset += bytes;
+		}
+		// pad to the cache alignment and return the new offset
+		uint64_t align() {
+			static const char zeros[CACHE_ALIGNMENT] = {};
+			uint64_t aligned = alignUp(offset);
+			write(zeros, aligned - offset);
+			return offset;
+		}
+	};
+
+	bool writeCache(const string& path, const SourceStamp& source, int lodLevels, const vector<Mesh>& meshes, const MipMap* texture) {
+		vector<shared_ptr<IntBuffer>> mips;
+		if (texture)
+			for (auto& level : texture->get_levels())
+				if (level) mips.push_back(level);
+
+		// every mesh is followed by its LODs
+		vector<const MeshGeometry*> geometries;
+		vector<CacheMesh> meshTable;
+		for (auto& mesh : meshes) {
+			geometries.push_back(mesh.geometry.get());
+			meshTable.push_back({});
+			for (size_t level = 0; level < mesh.lods.size(); level++) {
+				geometries.push_back(mesh.lods[level].geometry.get());
+				meshTable.push_back({});
+				meshTable.back().lodLevel = (uint32_t)level + 1;
+				meshTable.back().lodError = mesh.lods[level].error;
+			}
+		}
+
+		CacheHeader header = {};
+		memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+		header.version = CACHE_VERSION;
+		header.source = source;
+		header.meshCount = (uint32_t)meshTable.size();
+		header.mipCount = (uint32_t)mips.size();
+		header.lodLevels = (uint32_t)lodLevels;
+
+		// lay out the data blocks after the tables
+		vector<CacheMip> mipTable(mips.size());
+		uint64_t offset = sizeof(CacheHeader) + sizeof(CacheMesh) * meshTable.size() + sizeof(CacheMip) * mipTable.size();
+		for (size_t i = 0; i < meshTable.size(); i++) {
+			const MeshGeometry& mesh = *geometries[i];
+			CacheMesh& entry = meshTable[i];
+			entry.vertexCount = mesh.vertexCount();
+			entry.indexCount = mesh.indices.size();
+			entry.meshletCount = mesh.meshlets.size();
+			entry.positions = offset = alignUp(offset); offset += entry.vertexCount * sizeof(Vector3);
+			entry.normals = offset = alignUp(offset); offset += entry.vertexCount * sizeof(Vector3);
+			entry.texCoords = offset = alignUp(offset); offset += entry.vertexCount * sizeof(TexCoord);
+			entry.indices = offset = alignUp(offset); offset += entry.indexCount * sizeof(unsigned int);
+			entry.meshlets = offset = alignUp(offset); offset += entry.meshletCount * sizeof(Meshlet);
+			for (int k = 0; k < 3; k++) {
+				entry.boundsMin[k] = mesh.bounds.min[k];
+				entry.boundsMax[k] = mesh.bounds.max[k];
+				entry.sphere[k] = mesh.sphere.center[k];
+			}
+			entry.sphere[3] = mesh.sphere.radius;
+		}
+		for (size_t i = 0; i < mips.size(); i++) {
+			mipTable[i].width = (uint32_t)mips[i]->get_width();
+			mipTable[i].height = (uint32_t)mips[i]->get_height();
+			mipTable[i].offset = offset = alignUp(offset);
+			offset += mips[i]->get_size() * sizeof(int);
+		}
+
+		// write to a temporary file and rename, so readers never see a partial cache
+		string tempPath = path + ".tmp";
+		{
+			CacheWriter writer(tempPath);
+			if (!writer.isOpen()) return false;
+			writer.write(&header, sizeof(header));
+			writer.write(meshTable.data(), sizeof(CacheMesh) * meshTable.size());
+			writer.write(mipTable.data(), sizeof(CacheMip) * mipTable.size());
+			for (size_t i = 0; i < meshTable.size(); i++) {
+				const MeshGeometry& mesh = *geometries[i];
+				writer.align(); writer.write(mesh.positions.data(), meshTable[i].vertexCount * sizeof(Vector3));
+				writer.align(); writer.write(mesh.normals.data(), meshTable[i].vertexCount * sizeof(Vector3));
+				writer.align(); writer.write(mesh.texCoords.data(), meshTable[i].vertexCount * sizeof(TexCoord));
+				writer.align(); writer.write(mesh.indices.data(), meshTable[i].indexCount * sizeof(unsigned int));
+				writer.align(); writer.write(mesh.meshlets.data(), meshTable[i].meshletCount * sizeof(Meshlet));
+			}
+			for (auto& mip : mips) {
+				writer.align();
+				writer.write((*mip)(), mip->get_size() * sizeof(int));
+			}
+			assert(writer.tell() == offset);
+			if (!writer.good()) return false;
+		}
+
+		std::error_code ec;
+		std::filesystem::rename(tempPath, path, ec);
+		if (ec) std::filesystem::remove(tempPath, ec);
+		return !ec;
+	}
+
+	// count elements of elementSize bytes at offset lie within the file, without overflowing
+	inline bool inFile(const MappedFile& file, uint64_t offset, uint64_t count, uint64_t elementSize) {
+		return offset % CACHE_ALIGNMENT == 0 && offset <= file.get_size() && count <= (file.get_size() - offset) / elementSize;
+	}
+
+	// every index refers to a vertex and every meshlet to whole triangles of the index buffer
+	bool validTopology(const MeshGeometry& geometry) {
+		uint64_t vertexCount = geometry.positions.size(), indexCount = geometry.indices.size();
+		if (indexCount % 3 != 0) return false;
+		for (size_t i = 0; i < geometry.indices.size(); i++)
+			if (geometry.indices[i] >= vertexCount) return false;
+		for (size_t i = 0; i < geometry.meshlets.size(); i++) {
+			const Meshlet& meshlet = geometry.meshlets[i];
+			if ((uint64_t)meshlet.firstIndex + 3 * (uint64_t)meshlet.triangleCount > indexCount) return false;
+		}
+		return true;
+	}
+
+	bool loadCache(const string& path, const SourceStamp& source, int lodLevels, vector<Mesh>& meshes) {
+		auto file = make_shared<MappedFile>(path.c_str());
+		if (!file->isOpen() || file->get_size() < sizeof(CacheHeader)) return false;
+
+		const char* base = file->get_data();
+		const CacheHeader& header = *(const CacheHeader*)base;
+		if (memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != CACHE_VERSION ||
+			!sameSource(header.source, source) || header.lodLevels != (uint32_t)lodLevels)
+			return false;
+
+		uint64_t tableBytes = sizeof(CacheMesh) * (uint64_t)header.meshCount + sizeof(CacheMip) * (uint64_t)header.mipCount;
+		if (tableBytes > file->get_size() - sizeof(CacheHeader)) return false;
+		const CacheMesh* meshTable = (const CacheMesh*)(base + sizeof(CacheHeader));
+		const CacheMip* mipTable = (const CacheMip*)(meshTable + header.meshCount);
+
+		// texture levels view the mapping, the deleter keeps it alive
+		vector<shared_ptr<IntBuffer>> levels;
+		for (uint32_t i = 0; i < header.mipCount; i++) {
+			const CacheMip& mip = mipTable[i];
+			if (!inFile(*file, mip.offset, (uint64_t)mip.width * mip.height, sizeof(int))) return false;
+			int* pixels = (int*)(base + mip.offset);
+			levels.push_back(shared_ptr<IntBuffer>(new IntBuffer(mip.width, mip.height, pixels),
+				[file](IntBuffer* buffer) { delete buffer; }));
+		}
+		shared_ptr<const MipMap> texture;
+		if (!levels.empty()) texture = make_shared<const MipMap>(levels);
+
+		vector<Mesh> loaded;
+		for (uint32_t i = 0; i < header.meshCount; i++) {
+			const CacheMesh& entry = meshTable[i];
+			if (!inFile(*file, entry.positions, entry.vertexCount, sizeof(Vector3)) ||
+				!inFile(*file, entry.normals, entry.vertexCount, sizeof(Vector3)) ||
+				!inFile(*file, entry.texCoords, entry.vertexCount, sizeof(TexCoord)) ||
+				!inFile(*file, entry.indices, entry.indexCount, sizeof(unsigned int)) ||
+				!inFile(*file, entry.meshlets, entry.meshletCount, sizeof(Meshlet)))
+				return false;
+
+			auto geometry = make_shared<MeshGeometry>();
+			geometry->positions = ArrayView<Vector3>((const Vector3*)(base + entry.positions), entry.vertexCount);
+			geometry->normals = ArrayView<Vector3>((const Vector3*)(base + entry.normals), entry.vertexCount);
+			geometry->texCoords = ArrayView<TexCoord>((const TexCoord*)(base + entry.texCoords), entry.vertexCount);
+			geometry->indices = ArrayView<unsigned int>((const unsigned int*)(base + entry.indices), entry.indexCount);
+			geometry->meshlets = ArrayView<Meshlet>((const Meshlet*)(base + entry.meshlets), entry.meshletCount);
+			geometry->bounds.min = Vector3(entry.boundsMin[0], entry.boundsMin[1], entry.boundsMin[2]);
+			geometry->bounds.max = Vector3(entry.boundsMax[0], entry.boundsMax[1], entry.boundsMax[2]);
+			geometry->sphere.center = Vector3(entry.sphere[0], entry.sphere[1], entry.sphere[2]);
+			geometry->sphere.radius = entry.sphere[3];
+			geometry->storage = file;
+			// a damaged or foreign cache with a matching header is rebuilt rather than read out of bounds
+			if (!validTopology(*geometry)) return false;
+			if (entry.lodLevel == 0)
+				loaded.emplace_back(geometry, texture);
+			else if (!loaded.empty())
+				loaded.back().lods.push_back({ geometry, entry.lodError });
+			else
+				return false;
+		}
+
+		meshes.insert(meshes.end(), std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.end()));
+		return true;
+	}
+}
+
+bool LoadMeshCached(const char* objPath, vector<Mesh>& meshes, const char* texturePath, int lodLevels) {
+	string cachePath = string(objPath) + ".jmc";
+	SourceStamp source = stampSources(objPath, texturePath);
+	if (loadCache(cachePath, source, lodLevels, meshes)) return true;
+
+	vector<Mesh> parsed;
+	if (!LoadOBJ(objPath, parsed)) return false;
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int)parsed.size(); i++)
+		GenerateLODs(parsed[i], lodLevels);
+	shared_ptr<const MipMap> texture;
+	if (texturePath) {
+		auto image = CreateTexture(texturePath);
+		if (image) texture = make_shared<const MipMap>(image);
+	}
+
+	if (writeCache(cachePath, source, lodLevels, parsed, texture.get()) && loadCache(cachePath, source, lodLevels, meshes))
+		return true;
+
+	// the cache could not be written, use the parsed meshes directly
+	for (auto& mesh : parsed) {
+		mesh.texture = texture;
+		meshes.push_back(std::move(mesh));
+	}
+	return true;
+}
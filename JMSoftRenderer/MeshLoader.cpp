@@ -0,0 +1,340 @@
+#include "header/MeshLoader.h"
+#include "header/MappedFile.h"
+
+#include <cstring>
+#include <climits>
+
+namespace {
+
+	// 0-based indices of one face corner, -1 if the component is absent
+	struct FaceCorner {
+		int p, t, n;
+	};
+
+	// Parsing result of one chunk of the file
+	struct ObjChunk {
+		vector<Vector3> positions;
+		vector<Vector2> texCoords;
+		vector<Vector3> normals;
+		vector<FaceCorner> corners;		// 3 per triangle
+		vector<size_t> groupStarts;		// corner index where a new o/g/usemtl group starts
+		// corners that use negative (relative) indices, fixed up once the chunk's base is known
+		vector<size_t> relativeCorners;
+		vector<uint8_t> relativeMasks;	// bit0 p, bit1 t, bit2 n
+	};
+
+	inline bool isDigit(char c) { return c >= '0' && c <= '9'; }
+	inline bool isBlank(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+	inline const char* skipBlank(const char* p, const char* end) {
+		while (p < end && isBlank(*p)) p++;
+		return p;
+	}
+
+	inline double pow10(int e) {
+		static const double table[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		return e < 23 ? table[e] : std::pow(10.0, e);
+	}
+
+	// [+-]digits[.digits][(e|E)[+-]digits], without locale or allocation
+	inline const char* parseFloat(const char* p, const char* end, float& out) {
+		p = skipBlank(p, end);
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+		uint64_t mantissa = 0;
+		int digits = 0, exponent = 0;
+		for (; p < end && isDigit(*p); p++) {
+			if (digits < 18) {
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa) digits++;
+			}
+			else exponent++;
+		}
+		if (p < end && *p == '.') {
+			for (p++; p < end && isDigit(*p); p++) {
+				if (digits < 18) {
+					mantissa = mantissa * 10 + (*p - '0');
+					if (mantissa) digits++;
+					exponent--;
+				}
+			}
+		}
+		if (p < end && (*p == 'e' || *p == 'E')) {
+			p++;
+			bool negativeExp = false;
+			if (p < end && (*p == '-' || *p == '+')) negativeExp = *p++ == '-';
+			int e = 0;
+			for (; p < end && isDigit(*p); p++)
+				if (e < 10000) e = e * 10 + (*p - '0');
+			exponent += negativeExp ? -e : e;
+		}
+
+		double value = (double)mantissa;
+		if (exponent < 0) value /= pow10(-exponent);
+		else if (exponent > 0) value *= pow10(exponent);
+		out = (float)(negative ? -value : value);
+		return p;
+	}
+
+	inline const char* parseInt(const char* p, const char* end, int& out) {
+		bool negative = false;
+		if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+		int value = 0;
+		for (; p < end && isDigit(*p); p++) value = value * 10 + (*p - '0');
+		out = negative ? -value : value;
+		return p;
+	}
+
+	// Resolve a raw obj index to a 0-based index; negative indices are relative to
+	// the number of elements seen so far in this chunk and are flagged for fix up
+	inline int resolveIndex(int raw, size_t count, uint8_t bit, uint8_t& relativeMask) {
+		if (raw > 0) return raw - 1;
+		if (raw == 0) return -1;
+		relativeMask |= bit;
+		return (int)count + raw;
+	}
+
+	// v[/t][/n] or v//n
+	inline const char* parseCorner(const char* p, const char* end, const ObjChunk& chunk,
+		FaceCorner& corner, uint8_t& relativeMask) {
+		int v = 0, t = 0, n = 0;
+		p = parseInt(p, end, v);
+		if (p < end && *p == '/') {
+			p++;
+			if (p < end && *p != '/') p = parseInt(p, end, t);
+			if (p < end && *p == '/') p = parseInt(p + 1, end, n);
+		}
+		relativeMask = 0;
+		corner.p = resolveIndex(v, chunk.positions.size(), 1, relativeMask);
+		corner.t = resolveIndex(t, chunk.texCoords.size(), 2, relativeMask);
+		corner.n = resolveIndex(n, chunk.normals.size(), 4, relativeMask);
+		return p;
+	}
+
+	void parseChunk(const char* p, const char* end, ObjChunk& chunk) {
+		vector<FaceCorner> polygon;		// reused across faces
+		vector<uint8_t> polygonMasks;
+
+		while (p < end) {
+			const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+			if (!lineEnd) lineEnd = end;
+			p = skipBlank(p, lineEnd);
+
+			if (p + 1 < lineEnd) {
+				char c0 = p[0], c1 = p[1];
+				if (c0 == 'v' && isBlank(c1)) {
+					Vector3 v;
+					p = parseFloat(p + 1, lineEnd, v.x);
+					p = parseFloat(p, lineEnd, v.y);
+					p = parseFloat(p, lineEnd, v.z);
+					chunk.positions.push_back(v);
+				}
+				else if (c0 == 'v' && c1 == 't') {
+					Vector2 uv;
+					p = parseFloat(p + 2, lineEnd, uv.x);
+					p = parseFloat(p, lineEnd, uv.y);
+					chunk.texCoords.push_back(uv);
+				}
+				else if (c0 == 'v' && c1 == 'n') {
+					Vector3 n;
+					p = parseFloat(p + 2, lineEnd, n.x);
+					p = parseFloat(p, lineEnd, n.y);
+					p = parseFloat(p, lineEnd, n.z);
+					chunk.normals.push_back(n);
+				}
+				else if (c0 == 'f' && isBlank(c1)) {
+					int count = 0;
+					p = skipBlank(p + 1, lineEnd);
+					while (p < lineEnd) {
+						if ((int)polygon.size() == count) {
+							polygon.emplace_back();
+							polygonMasks.emplace_back();
+						}
+						const char* next = parseCorner(p, lineEnd, chunk, polygon[count], polygonMasks[count]);
+						if (next == p) break;	// not a corner, e.g. a trailing comment
+						count++;
+						p = skipBlank(next, lineEnd);
+					}
+					// fan triangulation
+					for (int i = 1; i + 1 < count; i++) {
+						const int fan[3] = { 0, i, i + 1 };
+						for (int k : fan) {
+							if (polygonMasks[k]) {
+								chunk.relativeCorners.push_back(chunk.corners.size());
+								chunk.relativeMasks.push_back(polygonMasks[k]);
+							}
+							chunk.corners.push_back(polygon[k]);
+						}
+					}
+				}
+				else if (((c0 == 'o' || c0 == 'g') && isBlank(c1)) ||
+					(lineEnd - p > 6 && strncmp(p, "usemtl", 6) == 0)) {
+					chunk.groupStarts.push_back(chunk.corners.size());
+				}
+			}
+			p = lineEnd + 1;
+		}
+	}
+
+	template <class T>
+	void concat(vector<T>& dst, const vector<ObjChunk>& chunks, vector<T> ObjChunk::* member, const vector<size_t>& bases) {
+		dst.resize(bases.back());
+#pragma omp parallel for
+		for (int i = 0; i < (int)chunks.size(); i++) {
+			const vector<T>& src = chunks[i].*member;
+			std::copy(src.begin(), src.end(), dst.begin() + bases[i]);
+		}
+	}
+
+	template <class T>
+	vector<size_t> prefixSum(const vector<ObjChunk>& chunks, vector<T> ObjChunk::* member) {
+		vector<size_t> bases(chunks.size() + 1, 0);
+		for (size_t i = 0; i < chunks.size(); i++)
+			bases[i + 1] = bases[i] + (chunks[i].*member).size();
+		return bases;
+	}
+
+	// Build one Mesh from the corners [first, last), merging identical corners.
+	// vertexHead is a per-thread table indexed by position (all UINT_MAX on entry and exit).
+	void buildMesh(Mesh& mesh, const FaceCorner* corners, size_t first, size_t last,
+		const vector<Vector3>& positions, const vector<Vector2>& texCoords, const vector<Vector3>& normals,
+		vector<unsigned int>& vertexHead) {
+		MeshBuffers buffers;
+		vector<unsigned int>& indices = buffers.indices;
+		vector<FaceCorner> keys;
+		vector<unsigned int> nextVertex;
+		bool missingNormals = false;
+
+		indices.reserve(last - first);
+		for (size_t i = first; i + 2 < last; i += 3) {
+			// skip the whole triangle before any of its corners becomes a vertex
+			bool valid = true;
+			for (int k = 0; k < 3; k++)
+				valid &= corners[i + k].p >= 0 && corners[i + k].p < (int)positions.size();
+			if (!valid) continue;
+
+			unsigned int triangle[3];
+			for (int k = 0; k < 3; k++) {
+				FaceCorner c = corners[i + k];
+				if (c.t < 0 || c.t >= (int)texCoords.size()) c.t = -1;
+				if (c.n < 0 || c.n >= (int)normals.size()) c.n = -1;
+
+				unsigned int index = vertexHead[c.p];
+				while (index != UINT_MAX && (keys[index].t != c.t || keys[index].n != c.n))
+					index = nextVertex[index];
+				if (index == UINT_MAX) {
+					index = (unsigned int)keys.size();
+					keys.push_back(c);
+					nextVertex.push_back(vertexHead[c.p]);
+					vertexHead[c.p] = index;
+				}
+				triangle[k] = index;
+			}
+			indices.insert(indices.end(), triangle, triangle + 3);
+		}
+
+		size_t vertexCount = keys.size();
+		buffers.positions.resize(vertexCount);
+		buffers.normals.resize(vertexCount);
+		buffers.texCoords.resize(vertexCount);
+		for (size_t i = 0; i < vertexCount; i++) {
+			const FaceCorner& c = keys[i];
+			buffers.positions[i] = positions[c.p];
+			if (c.t >= 0) buffers.texCoords[i] = texCoords[c.t];
+			if (c.n >= 0) buffers.normals[i] = normals[c.n];
+			missingNormals |= c.n < 0;
+			vertexHead[c.p] = UINT_MAX;
+		}
+
+		// area weighted face normals for vertices that have none
+		if (missingNormals) {
+			auto& p = buffers.positions;
+			for (size_t i = 0; i < indices.size(); i += 3) {
+				const unsigned int* tri = &indices[i];
+				Vector3 faceNormal = cross(p[tri[1]] - p[tri[0]], p[tri[2]] - p[tri[0]]);
+				for (int k = 0; k < 3; k++)
+					if (keys[tri[k]].n < 0) buffers.normals[tri[k]] += faceNormal;
+			}
+			for (size_t i = 0; i < vertexCount; i++)
+				if (keys[i].n < 0) buffers.normals[i].normalize();
+		}
+
+		mesh.geometry = MeshGeometry::Create(std::move(buffers));
+	}
+}
+
+bool LoadOBJ(const char* filename, vector<Mesh>& meshes) {
+	MappedFile file(filename);
+	if (!file.isOpen()) return false;
+	const char* begin = file.get_data();
+	const char* end = begin + file.get_size();
+
+	// split the file at line boundaries, about 256KB per chunk
+	int chunkCount = Math::clamp((int)(file.get_size() >> 18), 1, omp_get_max_threads() * 4);
+	vector<const char*> bounds(chunkCount + 1, end);
+	bounds[0] = begin;
+	for (int i = 1; i < chunkCount; i++) {
+		const char* p = begin + file.get_size() * i / chunkCount;
+		p = MAX(p, bounds[i - 1]);
+		const char* lineEnd = (const char*)memchr(p, '\n', end - p);
+		bounds[i] = lineEnd ? lineEnd + 1 : end;
+	}
+
+	vector<ObjChunk> chunks(chunkCount);
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < chunkCount; i++)
+		parseChunk(bounds[i], bounds[i + 1], chunks[i]);
+
+	// merge chunks
+	auto positionBases = prefixSum(chunks, &ObjChunk::positions);
+	auto texCoordBases = prefixSum(chunks, &ObjChunk::texCoords);
+	auto normalBases = prefixSum(chunks, &ObjChunk::normals);
+	auto cornerBases = prefixSum(chunks, &ObjChunk::corners);
+
+	vector<Vector3> positions, normals;
+	vector<Vector2> texCoords;
+	vector<FaceCorner> corners;
+	concat(positions, chunks, &ObjChunk::positions, positionBases);
+	concat(texCoords, chunks, &ObjChunk::texCoords, texCoordBases);
+	concat(normals, chunks, &ObjChunk::normals, normalBases);
+	concat(corners, chunks, &ObjChunk::corners, cornerBases);
+
+	vector<size_t> groupStarts;
+	for (size_t i = 0; i < chunks.size(); i++) {
+		for (size_t start : chunks[i].groupStarts)
+			groupStarts.push_back(cornerBases[i] + start);
+		for (size_t k = 0; k < chunks[i].relativeCorners.size(); k++) {
+			FaceCorner& c = corners[cornerBases[i] + chunks[i].relativeCorners[k]];
+			uint8_t mask = chunks[i].relativeMasks[k];
+			if (mask & 1) c.p += (int)positionBases[i];
+			if (mask & 2) c.t += (int)texCoordBases[i];
+			if (mask & 4) c.n += (int)normalBases[i];
+		}
+	}
+	groupStarts.push_back(corners.size());
+	chunks.clear();
+
+	// one mesh per non-empty group
+	vector<std::pair<size_t, size_t>> ranges;
+	size_t first = 0;
+	for (size_t start : groupStarts) {
+		if (start - first >= 3) ranges.push_back({ first, start });
+		first = MAX(first, start);
+	}
+
+	size_t meshBase = meshes.size();
+	meshes.resize(meshBase + ranges.size());
+#pragma omp parallel
+	{
+		vector<unsigned int> vertexHead(positions.size(), UINT_MAX);
+#pragma omp for schedule(dynamic)
+		for (int i = 0; i < (int)ranges.size(); i++)
+			buildMesh(meshes[meshBase + i], corners.data(), ranges[i].first, ranges[i].second,
+				positions, texCoords, normals, vertexHead);
+	}
+	return true;
+}
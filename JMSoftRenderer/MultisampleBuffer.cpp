@@ -0,0 +1,78 @@
+#include "header/MultisampleBuffer.h"
+
+#include <omp.h>
+
+const Vector2* MultisampleBuffer::pattern(int samples) {
+	static const Vector2 pattern2[] = {
+		Vector2(4, 4) / 16, Vector2(-4, -4) / 16
+	};
+	static const Vector2 pattern4[] = {
+		Vector2(-2, -6) / 16, Vector2(6, -2) / 16, Vector2(-6, 2) / 16, Vector2(2, 6) / 16
+	};
+	static const Vector2 pattern8[] = {
+		Vector2(1, -3) / 16, Vector2(-1, 3) / 16, Vector2(5, 1) / 16, Vector2(-3, -5) / 16,
+		Vector2(-5, 5) / 16, Vector2(-7, -1) / 16, Vector2(3, 7) / 16, Vector2(7, -7) / 16
+	};
+	static const Vector2 pattern1[] = { Vector2(0, 0) };
+	switch (samples) {
+	case 2: return pattern2;
+	case 4: return pattern4;
+	case 8: return pattern8;
+	default: return pattern1;
+	}
+}
+
+void MultisampleBuffer::resize(size_t width, size_t height, int samples) {
+	assert(samples == 2 || samples == 4 || samples == 8);
+	if (width == this->width && height == this->height && samples == this->samples) return;
+	this->width = width;
+	this->height = height;
+	this->samples = samples;
+	depth = make_shared<FloatBuffer>(width * samples, height);
+	pixelColor = make_shared<ColorBuffer>(width, height);
+	sampleColor = make_shared<ColorBuffer>(width * samples, height);
+	compressed.assign(width * height, 1);
+}
+
+void MultisampleBuffer::clear(const RGBColor& clearColor, float clearDepth) {
+	// every pixel is compressed after a clear, the sample colors need no clearing
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < (int)height; y++) {
+		float* d = (*depth)(0, y);
+		for (size_t i = 0; i < width * samples; i++) d[i] = clearDepth;
+		RGBColor* c = (*pixelColor)(0, y);
+		for (size_t x = 0; x < width; x++) c[x] = clearColor;
+	}
+	std::fill(compressed.begin(), compressed.end(), 1);
+}
+
+void MultisampleBuffer::resolve(ColorBuffer& target, FloatBuffer* farthestDepth) const {
+	assert(target.get_width() == width && target.get_height() == height);
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < (int)height; y++) {
+		if (farthestDepth) {
+			// depth is stored as rhw (or 1 / z), the farthest sample has the smallest value
+			const float* d = (*depth)(0, y);
+			float* out = (*farthestDepth)(0, y);
+			for (size_t x = 0; x < width; x++, d += samples) {
+				float farthest = d[0];
+				for (int s = 1; s < samples; s++) farthest = MIN(farthest, d[s]);
+				out[x] = farthest;
+			}
+		}
+
+		const RGBColor* pixel = (*pixelColor)(0, y);
+		const RGBColor* c = (*sampleColor)(0, y);
+		const unsigned char* packed = &compressed[(size_t)y * width];
+		RGBColor* out = target(0, y);
+		for (size_t x = 0; x < width; x++, c += samples) {
+			if (packed[x]) {
+				out[x] = pixel[x];
+				continue;
+			}
+			RGBColor sum = c[0];
+			for (int s = 1; s < samples; s++) sum += c[s];
+			out[x] = sum * (1.0f / samples);
+		}
+	}
+}
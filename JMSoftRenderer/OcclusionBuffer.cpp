@@ -0,0 +1,139 @@
+#include "header/OcclusionBuffer.h"
+
+#include <xmmintrin.h>
+
+namespace {
+	const int OCCLUSION_BAND_ROWS = 8;
+	const float OCCLUSION_NEAR_W = 1e-5f;
+}
+
+OcclusionBuffer::OcclusionBuffer(size_t width, size_t height) :
+	depth((width + 3) & ~(size_t)3, height),
+	width((int)((width + 3) & ~(size_t)3)),
+	height((int)height) {
+	clear();
+}
+
+void OcclusionBuffer::clear() {
+	depth.fill(1.0f);
+	triangles.clear();
+}
+
+void OcclusionBuffer::addOccluder(const MeshGeometry& geometry, const Matrix& mvp) {
+	vector<Vector4> clip(geometry.vertexCount());
+	for (size_t i = 0; i < clip.size(); i++)
+		mvp.apply(geometry.positions[i], clip[i]);
+
+	for (size_t i = 0; i + 2 < geometry.indices.size(); i += 3) {
+		OccluderTriangle tri;
+		bool valid = true;
+		tri.z = 0;
+		for (int k = 0; k < 3; k++) {
+			const Vector4& v = clip[geometry.indices[i + k]];
+			// triangles crossing the near plane are simply not used as occluders
+			if (v.w < OCCLUSION_NEAR_W || v.z < 0) { valid = false; break; }
+			float rhw = 1.0f / v.w;
+			tri.x[k] = (v.x * rhw * 0.5f + 0.5f) * width;
+			tri.y[k] = (0.5f - v.y * rhw * 0.5f) * height;
+			tri.z = MAX(tri.z, v.z * rhw);
+		}
+		if (!valid || tri.z > 1) continue;
+
+		// both sides occlude, wind every triangle the same way
+		float area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.y[1] - tri.y[0]) * (tri.x[2] - tri.x[0]);
+		if (area == 0) continue;
+		if (area < 0) {
+			swap(tri.x[1], tri.x[2]);
+			swap(tri.y[1], tri.y[2]);
+		}
+		float minY = MIN(tri.y[0], MIN(tri.y[1], tri.y[2])), maxY = MAX(tri.y[0], MAX(tri.y[1], tri.y[2]));
+		tri.minY = MAX((int)floor(minY), 0);
+		tri.maxY = MIN((int)ceil(maxY), height - 1);
+		float minX = MIN(tri.x[0], MIN(tri.x[1], tri.x[2])), maxX = MAX(tri.x[0], MAX(tri.x[1], tri.x[2]));
+		if (tri.minY > tri.maxY || maxX < 0 || minX >= width) continue;
+		triangles.push_back(tri);
+	}
+}
+
+void OcclusionBuffer::rasterize() {
+	// every band of rows belongs to one thread, so no pixel is written concurrently
+	int bands = (height + OCCLUSION_BAND_ROWS - 1) / OCCLUSION_BAND_ROWS;
+#pragma omp parallel for schedule(dynamic)
+	for (int band = 0; band < bands; band++)
+		rasterizeRows(band * OCCLUSION_BAND_ROWS, MIN((band + 1) * OCCLUSION_BAND_ROWS, height) - 1);
+}
+
+void OcclusionBuffer::rasterizeRows(int y0, int y1) {
+	const __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	for (const OccluderTriangle& tri : triangles) {
+		if (tri.maxY < y0 || tri.minY > y1) continue;
+		int rowBegin = MAX(tri.minY, y0), rowEnd = MIN(tri.maxY, y1);
+		float minX = MIN(tri.x[0], MIN(tri.x[1], tri.x[2])), maxX = MAX(tri.x[0], MAX(tri.x[1], tri.x[2]));
+		int xBegin = MAX((int)floor(minX), 0) & ~3, xEnd = MIN((int)ceil(maxX), width - 1);
+
+		// edge functions E = a * x + b * y + c evaluated at pixel centers. Only pixels
+		// completely inside the triangle are written, E must clear half the pixel extent
+		__m128 a[3], edgeRow[3], step[3], inner[3];
+		for (int k = 0; k < 3; k++) {
+			int n = (k + 1) % 3;
+			float ea = tri.y[k] - tri.y[n], eb = tri.x[n] - tri.x[k];
+			float ec = tri.x[k] * tri.y[n] - tri.y[k] * tri.x[n];
+			a[k] = _mm_set1_ps(ea);
+			inner[k] = _mm_set1_ps(0.5f * (fabs(ea) + fabs(eb)));
+			step[k] = _mm_set1_ps(ea * 4);
+			edgeRow[k] = _mm_set1_ps(eb * (rowBegin + 0.5f) + ec);
+			edgeRow[k] = _mm_add_ps(edgeRow[k], _mm_mul_ps(a[k], _mm_add_ps(_mm_set1_ps((float)xBegin), offsets)));
+		}
+		__m128 z = _mm_set1_ps(tri.z);
+
+		for (int y = rowBegin; y <= rowEnd; y++) {
+			float* row = depth(0, y);
+			__m128 e0 = edgeRow[0], e1 = edgeRow[1], e2 = edgeRow[2];
+			for (int x = xBegin; x <= xEnd; x += 4) {
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, inner[0]), _mm_cmpge_ps(e1, inner[1])), _mm_cmpge_ps(e2, inner[2]));
+				if (_mm_movemask_ps(inside)) {
+					__m128 d = _mm_loadu_ps(row + x);
+					__m128 nearer = _mm_min_ps(d, z);
+					_mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, d)));
+				}
+				e0 = _mm_add_ps(e0, step[0]);
+				e1 = _mm_add_ps(e1, step[1]);
+				e2 = _mm_add_ps(e2, step[2]);
+			}
+			for (int k = 0; k < 3; k++)
+				edgeRow[k] = _mm_add_ps(edgeRow[k], _mm_set1_ps(tri.x[(k + 1) % 3] - tri.x[k]));
+		}
+	}
+}
+
+bool OcclusionBuffer::isOccluded(const AABB& box, const Matrix& mvp) const {
+	if (triangles.empty() || box.isEmpty()) return false;
+
+	float minX = Math::Infinity, minY = Math::Infinity, maxX = -Math::Infinity, maxY = -Math::Infinity;
+	float nearest = Math::Infinity;
+	for (int i = 0; i < 8; i++) {
+		Vector3 corner(i & 1 ? box.max.x : box.min.x, i & 2 ? box.max.y : box.min.y, i & 4 ? box.max.z : box.min.z);
+		Vector4 v;
+		mvp.apply(corner, v);
+		// boxes touching the near plane are treated as visible
+		if (v.w < OCCLUSION_NEAR_W || v.z < 0) return false;
+		float rhw = 1.0f / v.w;
+		float x = (v.x * rhw * 0.5f + 0.5f) * width, y = (0.5f - v.y * rhw * 0.5f) * height;
+		minX = MIN(minX, x); maxX = MAX(maxX, x);
+		minY = MIN(minY, y); maxY = MAX(maxY, y);
+		nearest = MIN(nearest, v.z * rhw);
+	}
+
+	// every pixel the box might touch must hold a nearer occluder
+	int x0 = MAX((int)floor(minX), 0) & ~3, x1 = MIN((int)ceil(maxX), width - 1);
+	int y0 = MAX((int)floor(minY), 0), y1 = MIN((int)ceil(maxY), height - 1);
+	if (x0 > x1 || y0 > y1) return false;
+	__m128 boxDepth = _mm_set1_ps(nearest);
+	for (int y = y0; y <= y1; y++) {
+		const float* row = depth(0, y);
+		for (int x = x0; x <= x1; x += 4)
+			if (_mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(row + x), boxDepth)))
+				return false;
+	}
+	return true;
+}
@@ -2,273 +2,561 @@
 #include "header/Shader.h"
 #include <algorithm>
 
-void Pipeline::shading(TVertex& v, RGBColor& c, Vector2& dx, Vector2& dy) {
-	// Shadowmap sampling
+void Pipeline::shadeBRDF(RGBColor& c, const Vector3& N, const Vector3& L, const Vector3& V, float NdotL) {
+	if (shadingQuality == ShadingQuality::Reference)
+		Shader::PhysicallyBasedShading(c, roughness, metallic, N, L, V, NdotL);
+	else
+		Shader::PhysicallyBasedShadingFast(c, roughness, metallic, N, L, V, NdotL,
+			shadingQuality == ShadingQuality::FastLUT ? &visibilityLUT : nullptr);
+}
+
+void Pipeline::shading(const Vector3& worldPos, Vector3 N, const RGBColor& color, const Vector2& texCoord, const FragmentInput& frag, RGBColor& c) {
+	Vector3 V = -cameraPos - worldPos, L = dirLight.dir;
+	if (shadingQuality == ShadingQuality::Reference) {
+		N.normalize();
+		V.normalize();
+	}
+	else {
+		N = N * Math::rsqrt(MAX(N.lengthSqr(), 1e-30f));
+		V = V * Math::rsqrt(MAX(V.lengthSqr(), 1e-30f));
+	}
+	float NdotL = Math::clamp(N.dot(L));
+
+	float viewDepth = _matrix_V.apply(worldPos).z;
+
+	// Shadowmap sampling, ӿռѡ
 	float shadowAttenuation = 1;
 	if (enableShadow) {
-		auto clipPos_light = _matrix_light_VP.apply(v.worldPos + v.normal * 0.05f);// normal offset bias
-		Vector3 screenPos_light;
-		transformHomogenize(clipPos_light, screenPos_light, shadowBuffer.get_width(), shadowBuffer.get_height());
-		float shadowZ = shadowBuffer.tex2DScreenSpace(screenPos_light.x, screenPos_light.y);
-		//float shadowAttenuation = 1 - Math::clamp((shadowZ - 1.0f / screenPos_light.z - 0.1f) * 2.0f);
-		shadowAttenuation = shadowZ - 1.0f / screenPos_light.z > 0.1f ? 0 : 1;
+		int index = shadowCascades.select(viewDepth);
+		if (index >= 0) {
+			const ShadowCascade& cascade = shadowCascades[index];
+			const FloatBuffer& map = *cascade.depth;
+			// normal offset bias, 漶شС
+			float normalOffset = cascade.texelSize * (1.0f + 2.0f * sqrt(1.0f - NdotL * NdotL));
+			auto clipPos_light = cascade.viewProjection.apply(worldPos + N * normalOffset);
+			Vector3 screenPos_light;
+			transformHomogenize(clipPos_light, screenPos_light, map.get_width(), map.get_height());
+			shadowAttenuation = shadowCascades.sample(index, screenPos_light, shadowFilter, frag.x, frag.y);
+		}
 	}
 
-	Vector3 N = v.normal.normalize(),
-		V = (-cameraPos - v.worldPos).normalize(),
-		L = dirLight.dir;
-	float NdotL = Math::clamp(N.dot(L));
-
 	// texture samping
-	c = currentColor;
-	if (!currentTexture.isEmpty()) c *= currentTexture.SampleMipmap(v.texCoord, dx, dy, mipmapLevelOffset);
+	c = color;
+	if (currentTexture && !currentTexture->isEmpty()) c *= currentTexture->SampleMipmap(texCoord, frag.dx, frag.dy, mipmapLevelOffset + mipBias);
 
-	Shader::PhysicallyBasedShading(c, roughness, metallic, N, L, V, NdotL);
+	RGBColor albedo = c;
+	shadeBRDF(c, N, L, V, NdotL);
 	c *= dirLight.intensity * dirLight.color * NdotL * shadowAttenuation;
 
-
-}
-
-void Pipeline::rasterizeScanline(Scanline& scanline) {
-	if (scanline.y < 0 || scanline.y >= targetHeight) return;
-	int* fbPtr = renderBuffer(0, scanline.y);
-	float* zbPtr = ZBuffer(0, scanline.y);
-	int x0 = MAX(scanline.x0, 0), x1 = MIN(scanline.x1, targetWidth - 1);
-	TVertex vi = scanline.v0, v;
-	float invW = 1.f / targetWidth, invH = 1.f / targetHeight;
-	RGBColor c(0.5f, 0.5f, 0.5f);
-
-	//omp_set_lock(locks + scanline.y);
-	for (int x = x0; x <= x1; x++) {
-		// ͸ͶӰȽrhwֱӱȽ
-		float rhw = projectionMethod == ProjectionMethod::Perspective ? vi.rhw : 1.0f / vi.point.z;
-		float rhw_inv = 1.0f / rhw;
-		if (rhw >= zbPtr[x]) {  // Ƚ
-			v = vi * rhw_inv;// Բֵָ
-
-			// shading
-			shading(v, c, scanline.dx * rhw_inv, scanline.dy * rhw_inv);
-
-			fbPtr[x] = c.toRGBInt();
-			zbPtr[x] = rhw;
+	// Դ۹, ֻclusterĵƹ
+	if (!lightClusters.empty()) {
+		unsigned int count;
+		const unsigned short* indices = lightClusters.lights(frag.x, frag.y, viewDepth, count);
+		for (unsigned int i = 0; i < count; i++) {
+			const PunctualLight& light = (*lights)[indices[i]];
+			Vector3 toLight = light.position - worldPos;
+			float distance = toLight.length();
+			if (distance >= light.range) continue;
+			Vector3 Ll = toLight / MAX(distance, 1e-5f);
+			float NdotLl = N.dot(Ll);
+			if (NdotLl <= 0) continue;
+			float attenuation = light.attenuation(Ll, distance);
+			if (attenuation <= 0) continue;
+
+			RGBColor lightColor = albedo;
+			shadeBRDF(lightColor, N, Ll, V, NdotLl);
+			c += lightColor * light.color * (light.intensity * NdotLl * attenuation);
 		}
-		vi += scanline.step;// ֲֵÿ
 	}
-	//omp_unset_lock(locks + scanline.y);
+
+	// : SHնԤ˲ľ淴, һα
+	if (environment) c += environment->shade(albedo, roughness, metallic, N, V);
 
 }
 
-void Pipeline::rasterizeShadowMap(Scanline& scanline)
-{
-	if (scanline.y < 0 || scanline.y >= targetHeight) return;
-	int* fbPtr = renderBuffer(0, scanline.y);
-	float* zbPtr = shadowBuffer(0, scanline.y);
-	int x0 = MAX(scanline.x0, 0), x1 = MIN(scanline.x1, targetWidth - 1);
-	TVertex vi = scanline.v0;
-
-	for (int x = x0; x <= x1; x++) {
-		float z = 1.0f / vi.point.z;
-		if (z >= zbPtr[x]) {
-			fbPtr[x] = RGBColor(z * 0.1f, z * 0.1f, z * 0.1f).toRGBInt();
-			//fbPtr[x] = RGBColor(vi.worldPos.x, vi.worldPos.y, vi.worldPos.z).toRGBInt();
-			zbPtr[x] = z;
-		}
-		vi += scanline.step;// ֲֵÿ
+void Pipeline::renderOccluders(const Scene& scene) {
+	occlusionBuffer.clear();
+	currentOcclusion = false;
+	if (!enableOcclusion) return;
+
+	for (auto& instancedMesh : scene.meshes) {
+		const Mesh& mesh = instancedMesh.mesh;
+		// ͸οյMeshס
+		if (!mesh.occluder || mesh.blendMode != Opaque || !mesh.geometry) continue;
+		for (auto& instance : instancedMesh.instances)
+			occlusionBuffer.addOccluder(*mesh.geometry, instance.model * scene.model * _matrix_VP);
 	}
-
+	if (occlusionBuffer.isEmpty()) return;
+	occlusionBuffer.rasterize();
+	currentOcclusion = true;
 }
 
-void Pipeline::rasterizeTriangle(const SplitedTriangle& st) {
-	if (st.type & SplitedTriangle::FLAT_TOP) {
-		int y0 = (int)st.bottom.point.y + 1;
-		int y1 = (int)st.left.point.y;
-		float yl = st.left.point.y - st.bottom.point.y;
-		auto median_left = Math::lerp(st.left, st.bottom, 0.5),
-			median_right = Math::lerp(st.right, st.bottom, 0.5);
-		auto dx = (median_right.texCoord - median_left.texCoord) / (abs(median_right.point.x - median_left.point.x) + 1);
-		auto dy = (Math::lerp(st.left.texCoord, st.right.texCoord, 0.5) - st.bottom.texCoord) / (abs(y1 - y0) + 1);
-
-		for (int y = y0; y <= y1; y++) {
-			float factor = (y - st.bottom.point.y) / yl;
-			TVertex left = Math::lerp(st.bottom, st.left, factor);
-			TVertex right = Math::lerp(st.bottom, st.right, factor);
-			Scanline scanline;
-			scanline.x0 = (int)left.point.x;
-			scanline.x1 = (int)right.point.x;
-			scanline.y = y;
-			scanline.dx = dx;
-			scanline.dy = dy;
-			scanline.v0 = left;
-			scanline.step = (right - left) * (1.0f / (right.point.x - left.point.x));
-			(this->*currentRasterizeScanlineFunc)(scanline);
+void Pipeline::cullMeshlets(const MeshGeometry& geometry, size_t instanceCount) {
+	size_t vertexCount = geometry.vertexCount(), meshletCount = geometry.meshlets.size();
+	vertexVisible.assign(vertexCount * instanceCount, 0);
+	meshletVisible.assign(meshletCount * instanceCount, 0);
+
+	// ռв: ׶ƽMVPȡ, ӵMV任õ
+#pragma omp parallel for schedule(dynamic)
+	for (int instance = 0; instance < (int)instanceCount; instance++) {
+		CullResult meshResult = Intersect;
+		Frustum frustum;
+		ViewOrigin view;
+		if (enableCulling) {
+			frustum = Frustum(batchMatrix_MVP[instance]);
+			meshResult = frustum.test(geometry.sphere);
+			if (meshResult == Outside) continue;
+			if (currentOcclusion && occlusionBuffer.isOccluded(geometry.bounds, batchMatrix_MVP[instance])) continue;
+			view = ViewOrigin(batchMatrix_M[instance] * _matrix_V, _matrix_P);
 		}
-	}
-	if (st.type & SplitedTriangle::FLAT_BOTTOM) {
-		int y0 = (int)st.left.point.y + 1;
-		int y1 = (int)st.top.point.y;
-		float yl = st.top.point.y - st.left.point.y;
-		auto median_left = Math::lerp(st.left, st.top, 0.5),
-			median_right = Math::lerp(st.right, st.top, 0.5);
-		auto dx = (median_right.texCoord - median_left.texCoord) / (abs(median_right.point.x - median_left.point.x) + 1);
-		auto dy = (Math::lerp(st.left.texCoord, st.right.texCoord, 0.5) - st.top.texCoord) / (abs(y1 - y0) + 1);
-
-		for (int y = y0; y <= y1; y++) {
-			float factor = (y - st.left.point.y) / yl;
-			TVertex left = Math::lerp(st.left, st.top, factor);
-			TVertex right = Math::lerp(st.right, st.top, factor);
-			Scanline scanline;
-			scanline.x0 = (int)left.point.x;
-			scanline.x1 = (int)right.point.x;
-			scanline.y = y;
-			scanline.dx = dx;
-			scanline.dy = dy;
-			scanline.v0 = left;
-			scanline.step = (right - left) * (1.0f / (right.point.x - left.point.x));
-			(this->*currentRasterizeScanlineFunc)(scanline);
+
+		unsigned char* visible = &meshletVisible[instance * meshletCount];
+		unsigned char* vertices = &vertexVisible[instance * vertexCount];
+		for (size_t m = 0; m < meshletCount; m++) {
+			const Meshlet& meshlet = geometry.meshlets[m];
+			if (enableCulling) {
+				// Mesh׶ʱٲMeshlet
+				if (meshResult != Inside && frustum.test(meshlet.sphere) == Outside) continue;
+				if (view.isBackfacing(meshlet)) continue;
+				if (currentOcclusion) {
+					AABB box;
+					box.min = meshlet.sphere.center - Vector3(meshlet.sphere.radius);
+					box.max = meshlet.sphere.center + Vector3(meshlet.sphere.radius);
+					if (occlusionBuffer.isOccluded(box, batchMatrix_MVP[instance])) continue;
+				}
+			}
+			visible[m] = 1;
+			const unsigned int* index = &geometry.indices[meshlet.firstIndex];
+			for (unsigned int i = 0; i < meshlet.triangleCount * 3; i++)
+				vertices[index[i]] = 1;
 		}
 	}
-}
 
-void Pipeline::triangleSpilt(SplitedTriangle& st, const TVertex* v0, const TVertex* v1, const TVertex* v2) {
-	// ζ㰴Yv0 <= v1 <= v2
-	if (v0->point.y > v1->point.y) swap(v0, v1);
-	if (v0->point.y > v2->point.y) swap(v0, v2);
-	if (v1->point.y > v2->point.y) swap(v1, v2);
+	visibleMeshlets.clear();
+	for (size_t i = 0; i < meshletVisible.size(); i++)
+		if (meshletVisible[i])
+			visibleMeshlets.emplace_back((unsigned int)(i / meshletCount), (unsigned int)(i % meshletCount));
+}
 
-	// жι
-	if (Math::isZero(v0->point.y - v1->point.y) && Math::isZero(v1->point.y - v2->point.y) ||
-		Math::isZero(v0->point.x - v1->point.x) && Math::isZero(v1->point.x - v2->point.x)) {
-		st.type = SplitedTriangle::NONE;
-		return;
-	}
+void Pipeline::renderDepthTriangle(const unsigned int* index, size_t vertexBase) {
+	Vector4 clipPos[3];
+	Vector3 screenPos[3];
+	for (size_t i = 0; i < 3; i++)
+		clipPos[i] = clipPosCache[vertexBase + index[i]];
 
-	if (Math::isZero(v0->point.y - v1->point.y)) { // ױYȣƽΣ
-		assert(v2->point.y > v0->point.y);
-		if (v0->point.x > v1->point.x) swap(v0, v1);
+	int cvv[3] = { checkCVV(clipPos[0]), checkCVV(clipPos[1]), checkCVV(clipPos[2]) };
+	if (cvv[0] & cvv[1] & cvv[2]) return;// ͬһü֮
+	for (size_t i = 0; i < 3; i++)
+		transformHomogenize(clipPos[i], screenPos[i], targetWidth, targetHeight);
+	// ürenderTriangleһ, depthRasterizer
+	depthRasterizer.addTriangle(screenPos[0], screenPos[1], screenPos[2]);
+}
 
-		st.top = *v2;
-		st.left = *v0;
-		st.right = *v1;
-		st.type = SplitedTriangle::FLAT_BOTTOM;
-		return;
-	}
-	else if (Math::isZero(v1->point.y - v2->point.y)) { // YȣƽΣ
-		assert(v2->point.y > v0->point.y);
-		if (v1->point.x > v2->point.x) swap(v1, v2);
-
-		st.bottom = *v0;
-		st.left = *v1;
-		st.right = *v2;
-		st.type = SplitedTriangle::FLAT_TOP;
-		return;
+void Pipeline::transformVertices(const MeshGeometry& geometry, size_t instanceCount, bool withAttributes) {
+	size_t vertexCount = geometry.vertexCount();
+	int total = (int)(vertexCount * instanceCount);
+	if (clipPosCache.size() < (size_t)total) {
+		clipPosCache.resize(total);
+		worldPosCache.resize(total);
+		worldNormalCache.resize(total);
 	}
 
-	st.top = *v2;
-	st.bottom = *v0;
-	st.type = SplitedTriangle::FLAT_TOP_BOTTOM;
-
-	float factor = (v1->point.y - v0->point.y) / (v2->point.y - v0->point.y);
-	TVertex splitV = Math::lerp(st.bottom, st.top, factor);
-
-	if (splitV.point.x <= v1->point.x) {
-		st.left = splitV;
-		st.right = *v1;
-	}
-	else {
-		st.left = *v1;
-		st.right = splitV;
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < total; i++) {
+		if (!vertexVisible[i]) continue;
+		size_t instance = i / vertexCount, v = i % vertexCount;
+		batchMatrix_MVP[instance].apply(geometry.positions[v], clipPosCache[i]);
+		if (withAttributes) {
+			batchMatrix_M[instance].apply(geometry.positions[v], worldPosCache[i]);
+			batchMatrix_M[instance].applyDir(geometry.normals[v], worldNormalCache[i]);
+		}
 	}
 }
 
+int Pipeline::selectLOD(const Mesh& mesh, const Matrix& world) {
+	if (!enableLOD || mesh.lods.empty()) return 0;
+
+	// Χw, ͸ͶӰ¼ӿռ
+	const BoundingSphere& sphere = mesh.geometry->sphere;
+	float scale = 0;
+	for (int i = 0; i < 3; i++)
+		scale = MAX(scale, Vector3(world[i][0], world[i][1], world[i][2]).length());
+	Vector4 clipPos;
+	(world * _matrix_VP).apply(sphere.center, clipPos);
+	float w = clipPos.w - sphere.radius * scale * _matrix_P[2][3];
+	if (w <= 0) return 0;
+
+	// ѡͶӰlodErrorPixelsصLOD
+	float pixelsPerUnit = scale * fabs(_matrix_P[1][1]) * targetHeight * 0.5f / w;
+	int level = 0;
+	while (level < (int)mesh.lods.size() && mesh.lods[level].error * pixelsPerUnit <= lodErrorPixels)
+		level++;
+	return level;
+}
 
-void Pipeline::renderTriangle(const Vertex* v[3]) {
-	Vector4 clipPos[3];
-	Vector3 screenPos[3];
-	for (size_t i = 0; i < 3; i++) {
-		_matrix_MVP.apply(v[i]->point, clipPos[i]);
-	}
-	for (size_t i = 0; i < 3; i++)
-		transformHomogenize(clipPos[i], screenPos[i], targetWidth, targetHeight);
-
-	// cvvüȫĻȾ
-	int cvv[3] = { checkCVV(clipPos[0]), checkCVV(clipPos[1]), checkCVV(clipPos[2]) };
-	if (cvv[0] > 0 && cvv[1] > 0 && cvv[2] > 0) return;
-	// ü
-	if (cross(screenPos[1] - screenPos[0], screenPos[2] - screenPos[1]).z <= 0)
+void Pipeline::drawMesh(const InstancedMesh& instancedMesh, const Matrix& model, const vector<unsigned int>* order) {
+	const Mesh& mesh = instancedMesh.mesh;
+	if (!mesh.geometry) return;
+
+	// Mesh, ʵLOD
+	currentShader = mesh.shader ? mesh.shader.get() :
+		mesh.texture && !mesh.texture->isEmpty() ? (const MeshShader*)&standardTexturedShader : &standardShader;
+	currentTexture = mesh.texture.get();
+	currentColor = mesh.color;
+	currentBlend = mesh.blendMode;
+	currentOpacity = mesh.opacity;
+	currentAlphaCutoff = mesh.alphaCutoff;
+
+	// ʵĻߴLOD, LOD
+	const auto& instances = instancedMesh.instances;
+	lodInstances.resize(mesh.lods.size() + 1);
+	for (auto& list : lodInstances) list.clear();
+	auto skipped = [&](unsigned int i) { return currentInstanceMask && !currentInstanceMask[i]; };
+	if (order) {
+		// ָ˳, ֻLODͬʵϲΪһλ
+		for (size_t i = 0; i < order->size();) {
+			if (skipped((*order)[i])) { i++; continue; }
+			int level = selectLOD(mesh, instances[(*order)[i]].model * model);
+			vector<unsigned int>& run = lodInstances[level];
+			run.clear();
+			do run.push_back((*order)[i++]);
+			while (i < order->size() && !skipped((*order)[i]) && selectLOD(mesh, instances[(*order)[i]].model * model) == level);
+			drawInstances(level == 0 ? *mesh.geometry : *mesh.lods[level - 1].geometry, instances, run, model);
+		}
 		return;
+	}
+	for (size_t i = 0; i < instances.size(); i++)
+		if (!skipped((unsigned int)i)) lodInstances[selectLOD(mesh, instances[i].model * model)].push_back((unsigned int)i);
+	for (size_t level = 0; level <= mesh.lods.size(); level++)
+		if (!lodInstances[level].empty())
+			drawInstances(level == 0 ? *mesh.geometry : *mesh.lods[level - 1].geometry,
+				instances, lodInstances[level], model);
+}
 
-	TVertex tv[3];
-	SplitedTriangle st;
-	for (size_t i = 0; i < 3; i++) {
-		tv[i] = TVertex(
-			screenPos[i],
-			_matrix_M.apply(v[i]->point),
-			RGBColor(v[i]->texCoord.x, v[i]->texCoord.y, 1),
-			TexCoord(v[i]->texCoord.x, v[i]->texCoord.y),
-			_matrix_M.apply(v[i]->normal),
-			1);
-		tv[i].init_rhw(clipPos[i].w);
+void Pipeline::drawInstances(const MeshGeometry& geometry, const vector<Instance>& instances,
+	const vector<unsigned int>& selected, const Matrix& model) {
+	size_t vertexCount = geometry.vertexCount(), triangleCount = geometry.triangleCount();
+	if (vertexCount == 0 || triangleCount == 0) return;
+	currentGeometry = &geometry;
+	bool withAttributes = !depthOnlyPass;
+
+	// ÿԼINSTANCE_BATCH_VERTICES: ޳, ٱ任ɼ, дɼMeshlet
+	size_t batchSize = MAX(INSTANCE_BATCH_VERTICES / vertexCount, (size_t)1);
+	for (size_t first = 0; first < selected.size(); first += batchSize) {
+		size_t count = MIN(batchSize, selected.size() - first);
+		batchMatrix_M.resize(count);
+		batchMatrix_MVP.resize(count);
+		batchColor.resize(count);
+		for (size_t i = 0; i < count; i++) {
+			const Instance& instance = instances[selected[first + i]];
+			batchMatrix_M[i] = instance.model * model;
+			batchMatrix_MVP[i] = batchMatrix_M[i] * _matrix_VP;
+			batchColor[i] = currentColor * instance.color;
+		}
+		cullMeshlets(geometry, count);
+		if (visibleMeshlets.empty()) continue;
+		transformVertices(geometry, count, withAttributes);
+
+		// ɫPassMeshɫ, ʵĹդ
+		if (!depthOnlyPass) {
+			currentShader->draw(*this, geometry);
+			continue;
+		}
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)visibleMeshlets.size(); i++) {
+			size_t instance = visibleMeshlets[i].first;
+			const Meshlet& meshlet = geometry.meshlets[visibleMeshlets[i].second];
+			const unsigned int* index = &geometry.indices[meshlet.firstIndex];
+			for (unsigned int t = 0; t < meshlet.triangleCount; t++)
+				renderDepthTriangle(index + t * 3, instance * vertexCount);
+		}
 	}
-	triangleSpilt(st, &tv[0], &tv[1], &tv[2]);
-	rasterizeTriangle(st);
 }
 
 void Pipeline::renderMeshes(const Scene& scene)
 {
-	currentRasterizeScanlineFunc = &Pipeline::rasterizeScanline;
+	depthOnlyPass = false;
 	targetWidth = (int)renderBuffer.get_width();
 	targetHeight = (int)renderBuffer.get_height();
+	if (enableRayTracing) {
+		rayTracer.render(scene, hdrBuffer, clearColor, roughness, metallic, mipmapLevelOffset, enableShadow);
+		toneMapper.apply(hdrBuffer, renderBuffer);
+		if (enableFXAA) fxaa.apply(renderBuffer);
+		return;
+	}
 	_matrix_M = scene.model;
 	_matrix_V = scene.view;
 	_matrix_P = scene.projection;
-	_matrix_VP = scene.view * scene.projection;
+	mipBias = 0;
+	if (temporal) {// ȾϽ, ͶӰ֡Ĳλö
+		targetWidth = temporalUpsampler.get_renderWidth();
+		targetHeight = temporalUpsampler.get_renderHeight();
+		_matrix_P = temporalUpsampler.jitteredProjection(scene.projection);
+		mipBias = -1;
+	}
+	_matrix_VP = scene.view * _matrix_P;
 	_matrix_MVP = scene.model * _matrix_VP;
-	_matrix_light_VP = scene.view_light * scene.projection_light;
 	dirLight = scene.dirLight;
 	cameraPos = Vector3(_matrix_V[3][0], _matrix_V[3][1], _matrix_V[3][2]);
+	lights = &scene.lights;
+	environment = scene.environment.get();
+	if (shadingQuality == ShadingQuality::FastLUT && visibilityLUT.roughness != roughness)
+		visibilityLUT.build(roughness);
+
+	scissorTiles = false;
+	bool preview = false;
+	if (progressive) preview = updateProgressive(scene);
+	else if (enableIncremental && !multisampling && !temporal) updateDirtyTiles(scene);
+
+	coarseShading = enableVRS && !multisampling && !temporal && !preview;
+	if (coarseShading) {
+		shadingRates.resize(targetWidth, targetHeight);
+		coarseCaches.resize(omp_get_max_threads());
+		for (auto& cache : coarseCaches)
+			cache.samples.resize(targetWidth, CoarseSample{ 0, -1, false, RGBAColor() });
+	}
+	lightClusters.build(scene.lights, _matrix_V, _matrix_P, targetWidth, targetHeight);
+
+	// ûֿʱ(ֹȾϸ)ֱhdrBuffer
+	if (!scissorTiles || !dirtyTiles.isClean()) {
+		renderOccluders(scene);
+		bool hasTransparent = false;
+		for (size_t m = 0; m < scene.meshes.size(); m++) {
+			if (scene.meshes[m].mesh.blendMode == AlphaBlend) hasTransparent = true;
+			else {
+				currentInstanceMask = scissorTiles ? instanceDirty.data() + meshInstanceOffset[m] : nullptr;
+				drawMesh(scene.meshes[m], scene.model);
+			}
+		}
+		// ͸PassڽĵϽ, ȲʹøԶĲ
+		if (multisampling) multisampleBuffer.resolve(hdrBuffer, hasTransparent ? &ZBuffer : nullptr);
+		if (hasTransparent) renderTransparent(scene);
+	}
+	currentInstanceMask = nullptr;
+	scissorTiles = false;
+	if (temporal) {
+		temporalUpsampler.resolve(hdrBuffer, ZBuffer, scene.model * scene.view * scene.projection, scene.projection);
+		toneMapper.apply(temporalUpsampler.get_output(), renderBuffer);
+	}
+	else if (progressive) {
+		if (preview) progressiveRefiner.upsample(hdrBuffer);
+		else progressiveRefiner.copyTiles(hdrBuffer);
+		toneMapper.apply(progressiveRefiner.get_image(), renderBuffer);
+	}
+	else
+		toneMapper.apply(hdrBuffer, renderBuffer);
+	if (coarseShading) shadingRates.update(renderBuffer, vrsMaxError);// һ֡ɫ, FXAA֮ǰȡ
+	if (enableFXAA) fxaa.apply(renderBuffer);
+}
 
-	for (auto& mesh : scene.meshes)
-	{
-		currentShadeFunc = mesh.shadeFunc;
-		currentTexture = mesh.texture;
-		currentColor = mesh.color;
+void Pipeline::renderTransparent(const Scene& scene) {
+	if (transparencyMode == WeightedOIT) {
+		// ۻ˳޹, ˳ƺһκϳ
+		oitBuffer.resize(targetWidth, targetHeight);
+		oitBuffer.clear();
+		for (size_t m = 0; m < scene.meshes.size(); m++)
+			if (scene.meshes[m].mesh.blendMode == AlphaBlend) {
+				currentInstanceMask = scissorTiles ? instanceDirty.data() + meshInstanceOffset[m] : nullptr;
+				drawMesh(scene.meshes[m], scene.model);
+			}
+		oitBuffer.composite(hdrBuffer);
+		return;
+	}
 
-#pragma omp parallel for schedule(dynamic)
-		for (int i = 0; i < mesh.indices.size(); i += 3)
-		{
-			const Vertex* v[3] = {
-				&mesh.vertices[mesh.indices[i]],
-				&mesh.vertices[mesh.indices[i + 1]],
-				&mesh.vertices[mesh.indices[i + 2]]
-			};
-			renderTriangle(v);
+	// а͸ʵΧĵӿռȴԶ(ͬһʵڵβ)
+	transparentOrder.clear();
+	for (size_t m = 0; m < scene.meshes.size(); m++) {
+		const InstancedMesh& instancedMesh = scene.meshes[m];
+		if (instancedMesh.mesh.blendMode != AlphaBlend || !instancedMesh.mesh.geometry) continue;
+		const Vector3& center = instancedMesh.mesh.geometry->sphere.center;
+		for (size_t i = 0; i < instancedMesh.instances.size(); i++) {
+			float depth = _matrix_V.apply((instancedMesh.instances[i].model * scene.model).apply(center)).z;
+			transparentOrder.push_back({ depth, (unsigned int)m, (unsigned int)i });
 		}
 	}
+	std::stable_sort(transparentOrder.begin(), transparentOrder.end(),
+		[](const TransparentInstance& a, const TransparentInstance& b) { return a.depth > b.depth; });
+
+	// ͬһMeshڵʵһ
+	for (size_t first = 0; first < transparentOrder.size();) {
+		unsigned int mesh = transparentOrder[first].mesh;
+		sortedInstances.clear();
+		while (first < transparentOrder.size() && transparentOrder[first].mesh == mesh)
+			sortedInstances.push_back(transparentOrder[first++].instance);
+		currentInstanceMask = scissorTiles ? instanceDirty.data() + meshInstanceOffset[mesh] : nullptr;
+		drawMesh(scene.meshes[mesh], scene.model, &sortedInstances);
+	}
+}
+
+void Pipeline::updateDirtyTiles(const Scene& scene) {
+	listDrawables(scene);
+	dirtyTiles.finish();
+	clearDirtyTiles();
+}
+
+bool Pipeline::updateProgressive(const Scene& scene) {
+	listDrawables(scene);
+	dirtyTiles.finish();
+	if (dirtyTiles.isClean()) {// ֹ: ϸһֿ
+		progressiveRefiner.tilesPerFrame = progressiveTilesPerFrame;
+		progressiveRefiner.selectNextTiles(dirtyTiles);
+		clearDirtyTiles();
+		return false;
+	}
+
+	// б仯: ֡ÿһķֱȾϽ, ͶӰĿߴ(żߴʱ)
+	progressiveRefiner.restart();
+	targetWidth = progressiveRefiner.get_renderWidth();
+	targetHeight = progressiveRefiner.get_renderHeight();
+	float kx = renderBuffer.get_width() / (2.0f * targetWidth), ky = renderBuffer.get_height() / (2.0f * targetHeight);
+	for (int i = 0; i < 4; i++) {
+		_matrix_P[i][0] = kx * _matrix_P[i][0] + (kx - 1) * _matrix_P[i][3];
+		_matrix_P[i][1] = ky * _matrix_P[i][1] + (1 - ky) * _matrix_P[i][3];
+	}
+	_matrix_VP = _matrix_V * _matrix_P;
+	_matrix_MVP = _matrix_M * _matrix_VP;
+	clearTopLeft(targetWidth, targetHeight);
+	return true;
+}
+
+void Pipeline::listDrawables(const Scene& scene) {
+	dirtyTiles.begin(targetWidth, targetHeight);
+
+	// Ӱص״̬: , , Ⱦ
+	unsigned long long global = DirtyTiles::Hash(_matrix_VP);
+	auto hash = [&](const auto& value) { global = DirtyTiles::Hash(value, global); };
+	hash(dirLight);
+	hash(environment);
+	if (environment) hash(environment->intensity);
+	hash(clearColor);
+	hash(roughness), hash(metallic), hash(shadingQuality), hash(mipmapLevelOffset);
+	hash(enableShadow), hash(shadowFilter), hash(shadowDistance), hash(cascadeSplitLambda);
+	hash(enableLOD), hash(lodErrorPixels), hash(projectionMethod), hash(transparencyMode);
+	hash(enableVRS), hash(vrsMaxError);
+	// ͶӰ, ԴͶӰ仯ʱнߵӰҪ
+	if (enableShadow)
+		for (size_t i = 0; i < shadowCascades.size(); i++) hash(shadowCascades[i].viewProjection);
+	dirtyTiles.add(global, dirtyTiles.fullScreen());
+
+	// ÿʵ: ĻΧ, Ӱʱټع߷ͶӰΧ
+	instanceRects.clear();
+	meshInstanceOffset.clear();
+	for (auto& instancedMesh : scene.meshes) {
+		const Mesh& mesh = instancedMesh.mesh;
+		unsigned long long meshHash = DirtyTiles::Hash(mesh.geometry.get());
+		meshHash = DirtyTiles::Hash(mesh.texture.get(), meshHash);
+		meshHash = DirtyTiles::Hash(mesh.shader.get(), meshHash);
+		meshHash = DirtyTiles::Hash(mesh.color, meshHash);
+		meshHash = DirtyTiles::Hash(mesh.blendMode, meshHash);
+		meshHash = DirtyTiles::Hash(mesh.opacity, meshHash);
+		meshHash = DirtyTiles::Hash(mesh.alphaCutoff, meshHash);
+
+		meshInstanceOffset.push_back(instanceRects.size());
+		for (auto& instance : instancedMesh.instances) {
+			Matrix world = instance.model * scene.model;
+			DirtyTiles::Rect rect;
+			if (mesh.geometry) {
+				float scale = 0;
+				for (int i = 0; i < 3; i++)
+					scale = MAX(scale, Vector3(world[i][0], world[i][1], world[i][2]).length());
+				Vector3 center = world.apply(mesh.geometry->sphere.center);
+				float radius = mesh.geometry->sphere.radius * scale;
+				rect = dirtyTiles.projectSphere(center, radius, _matrix_VP,
+					enableShadow ? -dirLight.dir * shadowDistance : Vector3());
+			}
+			instanceRects.push_back(rect);
+			dirtyTiles.add(DirtyTiles::Hash(instance.color, DirtyTiles::Hash(world, meshHash)), rect);
+		}
+	}
+
+	// Դ۹ΧķΧ
+	for (auto& light : scene.lights) {
+		Vector3 center;
+		float radius;
+		light.bounds(center, radius);
+		dirtyTiles.add(DirtyTiles::Hash(light), dirtyTiles.projectSphere(center, radius, _matrix_VP));
+	}
+}
+
+void Pipeline::clearDirtyTiles() {
+	instanceDirty.resize(instanceRects.size());
+	for (size_t i = 0; i < instanceRects.size(); i++)
+		instanceDirty[i] = dirtyTiles.touches(instanceRects[i]);
+
+	// ֿ, رһ֡ɫ
+	if (dirtyTiles.isAll()) {
+		ZBuffer.fill(0.0f);
+		hdrBuffer.fill(clearColor);
+		return;
+	}
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < targetHeight; y++) {
+		const unsigned char* dirty = dirtyTiles.tileRow(y);
+		RGBColor* color = hdrBuffer(0, y);
+		float* depth = ZBuffer(0, y);
+		for (int x = 0; x < targetWidth; x++)
+			if (dirty[x / DirtyTiles::TILE_SIZE]) color[x] = clearColor, depth[x] = 0.0f;
+	}
+	scissorTiles = true;
 }
 
 void Pipeline::renderShadowMap(const Scene& scene)
 {
-	currentRasterizeScanlineFunc = &Pipeline::rasterizeShadowMap;
-	targetWidth = (int)shadowBuffer.get_width();
-	targetHeight = (int)shadowBuffer.get_height();
+	if (enableRayTracing) return;// Ӱɹ󽻵õ
+	depthOnlyPass = true;
 	_matrix_M = scene.model;
-	_matrix_V = scene.view_light;
-	_matrix_P = scene.projection_light;
-	_matrix_VP = scene.view_light * scene.projection_light;
-	_matrix_MVP = scene.model * _matrix_VP;
-	_matrix_light_VP = _matrix_VP;
+	currentOcclusion = false;
+	currentInstanceMask = nullptr;
+
+	// ͶӰԴ, ʹͶӰ
+	// AlphaBlendMeshͶӰ, AlphaTestMeshݰ͸Ͷ
+	float casterMinZ = Math::Infinity;
+	for (auto& instancedMesh : scene.meshes) {
+		const MeshGeometry* geometry = instancedMesh.mesh.geometry.get();
+		if (!geometry || instancedMesh.mesh.blendMode == AlphaBlend) continue;
+		for (auto& instance : instancedMesh.instances) {
+			Matrix world = instance.model * scene.model;
+			float scale = 0;
+			for (int i = 0; i < 3; i++)
+				scale = MAX(scale, Vector3(world[i][0], world[i][1], world[i][2]).length());
+			Vector3 center = scene.view_light.apply(world.apply(geometry->sphere.center));
+			casterMinZ = MIN(casterMinZ, center.z - geometry->sphere.radius * scale);
+		}
+	}
+	shadowCascades.fit(scene.view, scene.projection, shadowDistance, cascadeSplitLambda, scene.view_light, casterMinZ);
 
+	bool hasDynamic = false;
 	for (auto& mesh : scene.meshes)
-	{
-#pragma omp parallel for schedule(dynamic)
-		for (int i = 0; i < mesh.indices.size(); i += 3)
-		{
-			const Vertex* v[3] = {
-				&mesh.vertices[mesh.indices[i]],
-				&mesh.vertices[mesh.indices[i + 1]],
-				&mesh.vertices[mesh.indices[i + 2]]
-			};
-			renderTriangle(v);
+		hasDynamic |= mesh.mesh.dynamic && mesh.mesh.blendMode != AlphaBlend;
+	if (!enableShadowCache) shadowCascades.clear();
+
+	for (size_t i = 0; i < shadowCascades.size(); i++) {
+		const ShadowCascade& cascade = shadowCascades[i];
+		currentShadowBuffer = cascade.depth.get();
+		targetWidth = (int)currentShadowBuffer->get_width();
+		targetHeight = (int)currentShadowBuffer->get_height();
+		_matrix_V = cascade.view;
+		_matrix_P = cascade.projection;
+		_matrix_VP = cascade.viewProjection;
+		_matrix_MVP = scene.model * _matrix_VP;
+
+		// Դ뾲̬Meshδ仯ʱֱûľ̬
+		if (!shadowCascades.restoreStatic(i, _matrix_MVP, scene.staticVersion)) {
+			depthRasterizer.begin(targetWidth, targetHeight);
+			for (auto& mesh : scene.meshes)
+				if (!mesh.mesh.dynamic && mesh.mesh.blendMode != AlphaBlend) drawMesh(mesh, scene.model);
+			depthRasterizer.flush(*currentShadowBuffer);
+			shadowCascades.storeStatic(i, _matrix_MVP, scene.staticVersion);
+		}
+
+		// ̬Meshÿ֡ھ̬֮
+		if (hasDynamic) {
+			shadowCascades.beginDynamic(i);
+			depthRasterizer.begin(targetWidth, targetHeight);
+			for (auto& mesh : scene.meshes)
+				if (mesh.mesh.dynamic && mesh.mesh.blendMode != AlphaBlend) drawMesh(mesh, scene.model);
+			depthRasterizer.flush(*currentShadowBuffer);
 		}
 	}
+	shadowCascades.prefilter(shadowFilter);
 }
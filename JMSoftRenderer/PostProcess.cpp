@@ -0,0 +1,252 @@
+#include "header/PostProcess.h"
+
+#include <emmintrin.h>
+#include <omp.h>
+#include <cstring>
+
+namespace {
+	const int FXAA_TILE = 64;
+	// step lengths of the search along the edge, in pixels
+	const float FXAA_SEARCH_STEPS[] = { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.5f, 2.0f, 2.0f, 2.0f, 2.0f, 4.0f, 8.0f };
+	const int FXAA_SEARCH_COUNT = sizeof(FXAA_SEARCH_STEPS) / sizeof(float);
+
+	inline float Luma(int c) {
+		return (((c >> 16) & 0xff) * 0.299f + ((c >> 8) & 0xff) * 0.587f + (c & 0xff) * 0.114f) * (1.0f / 255);
+	}
+
+	// per channel lerp of two packed RGB colors
+	inline int Blend(int a, int b, float t) {
+		int w = (int)(t * 256 + 0.5f);
+		int r = ((a >> 16) & 0xff) * (256 - w) + ((b >> 16) & 0xff) * w;
+		int g = ((a >> 8) & 0xff) * (256 - w) + ((b >> 8) & 0xff) * w;
+		int bl = (a & 0xff) * (256 - w) + (b & 0xff) * w;
+		return ((r >> 8) << 16) | ((g >> 8) << 8) | (bl >> 8);
+	}
+}
+
+float FXAA::lumaAt(float x, float y) const {
+	x = Math::clamp(x, 0.0f, (float)(width - 1));
+	y = Math::clamp(y, 0.0f, (float)(height - 1));
+	int x0 = (int)x, y0 = (int)y;
+	float fx = x - x0, fy = y - y0;
+	size_t stride = width + 2;
+	const float* p = &luma[(y0 + 1) * stride + x0 + 1];
+	return (p[0] * (1 - fx) + p[1] * fx) * (1 - fy) + (p[stride] * (1 - fx) + p[stride + 1] * fx) * fy;
+}
+
+int FXAA::filterPixel(int x, int y) const {
+	size_t stride = width + 2;
+	const float* p = &luma[(y + 1) * stride + x + 1];
+	float lumaM = p[0], lumaN = p[-(ptrdiff_t)stride], lumaS = p[stride], lumaW = p[-1], lumaE = p[1];
+	float lumaMax = MAX(lumaM, MAX(MAX(lumaN, lumaS), MAX(lumaW, lumaE)));
+	float lumaMin = MIN(lumaM, MIN(MIN(lumaN, lumaS), MIN(lumaW, lumaE)));
+	float range = lumaMax - lumaMin;
+	int color = source[(size_t)y * width + x];
+	if (range < MAX(edgeThresholdMin, lumaMax * edgeThreshold)) return color;
+
+	// a horizontal edge changes luma vertically
+	float lumaNW = p[-(ptrdiff_t)stride - 1], lumaNE = p[-(ptrdiff_t)stride + 1], lumaSW = p[stride - 1], lumaSE = p[stride + 1];
+	float edgeHorizontal = fabs(lumaNW + lumaSW - 2 * lumaW) + 2 * fabs(lumaN + lumaS - 2 * lumaM) + fabs(lumaNE + lumaSE - 2 * lumaE);
+	float edgeVertical = fabs(lumaNW + lumaNE - 2 * lumaN) + 2 * fabs(lumaW + lumaE - 2 * lumaM) + fabs(lumaSW + lumaSE - 2 * lumaS);
+	bool horizontal = edgeHorizontal >= edgeVertical;
+
+	// the side of the edge with the steeper gradient
+	float luma1 = horizontal ? lumaN : lumaW, luma2 = horizontal ? lumaS : lumaE;
+	float gradient1 = luma1 - lumaM, gradient2 = luma2 - lumaM;
+	bool steepest1 = fabs(gradient1) >= fabs(gradient2);
+	float gradientScaled = 0.25f * MAX(fabs(gradient1), fabs(gradient2));
+	int step = steepest1 ? -1 : 1;
+	float lumaLocalAverage = 0.5f * ((steepest1 ? luma1 : luma2) + lumaM);
+
+	// search both ways along the edge, half a pixel towards that side, until the luma leaves the edge
+	float edgeX = (float)x, edgeY = (float)y;
+	if (horizontal) edgeY += step * 0.5f;
+	else edgeX += step * 0.5f;
+	float dirX = horizontal ? 1.0f : 0.0f, dirY = horizontal ? 0.0f : 1.0f;
+	float x1 = edgeX - dirX, y1 = edgeY - dirY, x2 = edgeX + dirX, y2 = edgeY + dirY;
+	float end1 = lumaAt(x1, y1) - lumaLocalAverage, end2 = lumaAt(x2, y2) - lumaLocalAverage;
+	bool reached1 = fabs(end1) >= gradientScaled, reached2 = fabs(end2) >= gradientScaled;
+	for (int i = 1; i < FXAA_SEARCH_COUNT && !(reached1 && reached2); i++) {
+		if (!reached1) {
+			x1 -= dirX * FXAA_SEARCH_STEPS[i];
+			y1 -= dirY * FXAA_SEARCH_STEPS[i];
+			end1 = lumaAt(x1, y1) - lumaLocalAverage;
+			reached1 = fabs(end1) >= gradientScaled;
+		}
+		if (!reached2) {
+			x2 += dirX * FXAA_SEARCH_STEPS[i];
+			y2 += dirY * FXAA_SEARCH_STEPS[i];
+			end2 = lumaAt(x2, y2) - lumaLocalAverage;
+			reached2 = fabs(end2) >= gradientScaled;
+		}
+	}
+
+	// blend by the position within the edge span, only on the side where the edge ends in the right direction
+	float distance1 = horizontal ? x - x1 : y - y1, distance2 = horizontal ? x2 - x : y2 - y;
+	bool direction1 = distance1 < distance2;
+	float pixelOffset = 0.5f - MIN(distance1, distance2) / (distance1 + distance2);
+	bool centerSmaller = lumaM < lumaLocalAverage;
+	float finalOffset = ((direction1 ? end1 : end2) < 0) != centerSmaller ? pixelOffset : 0.0f;
+
+	// sub-pixel aliasing: contrast of the pixel against its 3x3 neighbourhood
+	float lumaAverage = (2 * (lumaN + lumaS + lumaW + lumaE) + lumaNW + lumaNE + lumaSW + lumaSE) * (1.0f / 12);
+	float subpixel = Math::clamp(fabs(lumaAverage - lumaM) / range);
+	subpixel = (-2 * subpixel + 3) * subpixel * subpixel;
+	finalOffset = MAX(finalOffset, subpixel * subpixel * subpixelQuality);
+
+	int nx = horizontal ? x : Math::clamp(x + step, 0, width - 1);
+	int ny = horizontal ? Math::clamp(y + step, 0, height - 1) : y;
+	return Blend(color, source[(size_t)ny * width + nx], finalOffset);
+}
+
+void FXAA::apply(IntBuffer& image) {
+	width = (int)image.get_width();
+	height = (int)image.get_height();
+	size_t stride = width + 2;
+	luma.resize(stride * (height + 2));
+	source.resize((size_t)width * height);
+
+	// copy the image and compute its luma, 4 pixels at a time
+	const __m128i channel = _mm_set1_epi32(0xff);
+	const __m128 weightR = _mm_set1_ps(0.299f / 255), weightG = _mm_set1_ps(0.587f / 255), weightB = _mm_set1_ps(0.114f / 255);
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < height; y++) {
+		const int* in = image(0, y);
+		memcpy(&source[(size_t)y * width], in, width * sizeof(int));
+		float* out = &luma[(y + 1) * stride + 1];
+		int x = 0;
+		for (; x + 4 <= width; x += 4) {
+			__m128i c = _mm_loadu_si128((const __m128i*)(in + x));
+			__m128 r = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 16), channel));
+			__m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(c, 8), channel));
+			__m128 b = _mm_cvtepi32_ps(_mm_and_si128(c, channel));
+			_mm_storeu_ps(out + x, _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, weightR), _mm_mul_ps(g, weightG)), _mm_mul_ps(b, weightB)));
+		}
+		for (; x < width; x++) out[x] = Luma(in[x]);
+		out[-1] = out[0];
+		out[width] = out[width - 1];
+	}
+	memcpy(&luma[0], &luma[stride], stride * sizeof(float));
+	memcpy(&luma[(height + 1) * stride], &luma[height * stride], stride * sizeof(float));
+
+	// filter in tiles, the SSE contrast test rejects most pixels 4 at a time
+	const __m128 threshold = _mm_set1_ps(edgeThreshold), thresholdMin = _mm_set1_ps(edgeThresholdMin);
+	int tilesX = (width + FXAA_TILE - 1) / FXAA_TILE, tilesY = (height + FXAA_TILE - 1) / FXAA_TILE;
+#pragma omp parallel for schedule(dynamic)
+	for (int tile = 0; tile < tilesX * tilesY; tile++) {
+		int x0 = tile % tilesX * FXAA_TILE, y0 = tile / tilesX * FXAA_TILE;
+		int x1 = MIN(x0 + FXAA_TILE, width), y1 = MIN(y0 + FXAA_TILE, height);
+		for (int y = y0; y < y1; y++) {
+			int* out = image(0, y);
+			const float* row = &luma[(y + 1) * stride + 1];
+			int x = x0;
+			for (; x + 4 <= x1; x += 4) {
+				__m128 m = _mm_loadu_ps(row + x);
+				__m128 n = _mm_loadu_ps(row + x - stride), s = _mm_loadu_ps(row + x + stride);
+				__m128 w = _mm_loadu_ps(row + x - 1), e = _mm_loadu_ps(row + x + 1);
+				__m128 lumaMax = _mm_max_ps(m, _mm_max_ps(_mm_max_ps(n, s), _mm_max_ps(w, e)));
+				__m128 lumaMin = _mm_min_ps(m, _mm_min_ps(_mm_min_ps(n, s), _mm_min_ps(w, e)));
+				__m128 limit = _mm_max_ps(thresholdMin, _mm_mul_ps(lumaMax, threshold));
+				int edges = _mm_movemask_ps(_mm_cmpge_ps(_mm_sub_ps(lumaMax, lumaMin), limit));
+				for (int i = 0; edges; i++, edges >>= 1)
+					if (edges & 1) out[x + i] = filterPixel(x + i, y);
+			}
+			for (; x < x1; x++) out[x] = filterPixel(x, y);
+		}
+	}
+}
+
+namespace {
+	// 4x4 Bayer matrix as offsets in (-0.5, 0.5) of one 8 bit step
+	const float BAYER_4X4[4][4] = {
+		{ 0.5f / 16 - 0.5f, 8.5f / 16 - 0.5f, 2.5f / 16 - 0.5f, 10.5f / 16 - 0.5f },
+		{ 12.5f / 16 - 0.5f, 4.5f / 16 - 0.5f, 14.5f / 16 - 0.5f, 6.5f / 16 - 0.5f },
+		{ 3.5f / 16 - 0.5f, 11.5f / 16 - 0.5f, 1.5f / 16 - 0.5f, 9.5f / 16 - 0.5f },
+		{ 15.5f / 16 - 0.5f, 7.5f / 16 - 0.5f, 13.5f / 16 - 0.5f, 5.5f / 16 - 0.5f },
+	};
+
+	template <ToneMapping M>
+	inline __m128 ToneCurve(__m128 x) {
+		const __m128 one = _mm_set1_ps(1.0f);
+		x = _mm_max_ps(x, _mm_setzero_ps());	// also maps NaN to 0
+		if (M == Reinhard)
+			x = _mm_div_ps(x, _mm_add_ps(x, one));
+		if (M == ACESFilmic) {
+			__m128 a = _mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(2.51f)), _mm_set1_ps(0.03f)));
+			__m128 b = _mm_add_ps(_mm_mul_ps(x, _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(2.43f)), _mm_set1_ps(0.59f))), _mm_set1_ps(0.14f));
+			x = _mm_div_ps(a, b);
+		}
+		return _mm_min_ps(x, one);
+	}
+
+	// Tone map 4 pixels (12 floats, RGB interleaved) to 12 channel values in [0, 255].
+	// dither holds the offsets of the 4 pixels spread over the 12 channels, table is null for gamma 1.
+	template <ToneMapping M>
+	inline void ToneMap4(const float* in, const __m128 dither[3], __m128 exposure, const float* table, int tableSize, int* out) {
+		for (int k = 0; k < 3; k++) {
+			__m128 c = ToneCurve<M>(_mm_mul_ps(_mm_loadu_ps(in + k * 4), exposure));
+			__m128 e;
+			if (!table)
+				e = _mm_mul_ps(c, _mm_set1_ps(255.0f));
+			else {
+				// linear in the table between sqrt(c) steps
+				__m128 t = _mm_mul_ps(_mm_sqrt_ps(c), _mm_set1_ps((float)tableSize));
+				__m128i i = _mm_cvttps_epi32(t);
+				__m128 f = _mm_sub_ps(t, _mm_cvtepi32_ps(i));
+				alignas(16) int index[4];
+				_mm_store_si128((__m128i*)index, i);
+				__m128 e0 = _mm_setr_ps(table[index[0]], table[index[1]], table[index[2]], table[index[3]]);
+				__m128 e1 = _mm_setr_ps(table[index[0] + 1], table[index[1] + 1], table[index[2] + 1], table[index[3] + 1]);
+				e = _mm_add_ps(e0, _mm_mul_ps(_mm_sub_ps(e1, e0), f));
+			}
+			// |dither| < 0.5 keeps the rounded value within [0, 255]
+			_mm_storeu_si128((__m128i*)(out + k * 4), _mm_cvttps_epi32(_mm_add_ps(e, _mm_add_ps(dither[k], _mm_set1_ps(0.5f)))));
+		}
+	}
+
+	template <ToneMapping M>
+	void ToneMapImage(const ColorBuffer& hdr, IntBuffer& image, float exposure, bool dither, const float* table, int tableSize) {
+		static_assert(sizeof(RGBColor) == 3 * sizeof(float), "RGBColor must be 3 packed floats");
+		int width = (int)image.get_width(), height = (int)image.get_height();
+		const __m128 exposure4 = _mm_set1_ps(exposure);
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < height; y++) {
+			// Bayer offsets of this row, one per channel of 4 pixels
+			alignas(16) float offsets[12];
+			for (int k = 0; k < 12; k++) offsets[k] = dither ? BAYER_4X4[y & 3][k / 3] : 0.0f;
+			const __m128 dither4[3] = { _mm_load_ps(offsets), _mm_load_ps(offsets + 4), _mm_load_ps(offsets + 8) };
+
+			const float* in = (const float*)hdr(0, y);
+			int* out = image(0, y);
+			alignas(16) int rgb[12];
+			for (int x = 0; x < width; x += 4) {
+				const float* src = in + x * 3;
+				float tail[12] = {};
+				int count = MIN(width - x, 4);
+				if (count < 4) {
+					memcpy(tail, src, count * 3 * sizeof(float));
+					src = tail;
+				}
+				ToneMap4<M>(src, dither4, exposure4, table, tableSize, rgb);
+				for (int p = 0; p < count; p++)
+					out[x + p] = (rgb[p * 3] << 16) | (rgb[p * 3 + 1] << 8) | rgb[p * 3 + 2];
+			}
+		}
+	}
+}
+
+void ToneMapper::apply(const ColorBuffer& hdr, IntBuffer& image) {
+	assert(hdr.get_width() == image.get_width() && hdr.get_height() == image.get_height());
+	if (gamma != tableGamma) {
+		for (int i = 0; i <= TABLE_SIZE; i++)
+			encodeTable[i] = 255 * pow((float)i / TABLE_SIZE, 2 / gamma);
+		encodeTable[TABLE_SIZE + 1] = encodeTable[TABLE_SIZE];
+		tableGamma = gamma;
+	}
+	const float* table = gamma == 1.0f ? nullptr : encodeTable;
+	switch (mapping) {
+	case Reinhard: ToneMapImage<Reinhard>(hdr, image, exposure, dither, table, TABLE_SIZE); break;
+	case ACESFilmic: ToneMapImage<ACESFilmic>(hdr, image, exposure, dither, table, TABLE_SIZE); break;
+	default: ToneMapImage<LinearClamp>(hdr, image, exposure, dither, table, TABLE_SIZE); break;
+	}
+}
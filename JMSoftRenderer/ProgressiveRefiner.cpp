@@ -0,0 +1,59 @@
+#include "header/ProgressiveRefiner.h"
+
+#include <omp.h>
+#include <algorithm>
+
+void ProgressiveRefiner::resize(size_t width, size_t height) {
+	if (width == this->width && height == this->height) return;
+	this->width = width;
+	this->height = height;
+	image = make_shared<ColorBuffer>(width, height);
+
+	const int size = DirtyTiles::TILE_SIZE;
+	tilesX = (int)(width + size - 1) / size;
+	int tilesY = (int)(height + size - 1) / size;
+	vector<float> distance(tilesX * tilesY);
+	order.resize(tilesX * tilesY);
+	for (int i = 0; i < (int)order.size(); i++) {
+		float dx = ((i % tilesX) + 0.5f) * size - width * 0.5f, dy = ((i / tilesX) + 0.5f) * size - height * 0.5f;
+		distance[i] = dx * dx + dy * dy;
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return distance[a] < distance[b]; });
+	restart();
+}
+
+void ProgressiveRefiner::selectNextTiles(DirtyTiles& tiles) {
+	batch = MIN((size_t)tilesPerFrame, order.size() - refined);
+	refined += batch;
+	tiles.select(order.data() + refined - batch, batch);
+}
+
+void ProgressiveRefiner::upsample(const ColorBuffer& color) {
+	// preview pixel (X, Y) samples output pixel (2X, 2Y)
+	int renderWidth = get_renderWidth(), renderHeight = get_renderHeight();
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < (int)height; y++) {
+		int Y0 = y >> 1, Y1 = MIN(Y0 + 1, renderHeight - 1);
+		float fy = (y & 1) * 0.5f;
+		const RGBColor* row0 = color(0, Y0);
+		const RGBColor* row1 = color(0, Y1);
+		RGBColor* out = (*image)(0, y);
+		for (int x = 0; x < (int)width; x++) {
+			int X0 = x >> 1, X1 = MIN(X0 + 1, renderWidth - 1);
+			float fx = (x & 1) * 0.5f;
+			out[x] = (row0[X0] * (1 - fx) + row0[X1] * fx) * (1 - fy) + (row1[X0] * (1 - fx) + row1[X1] * fx) * fy;
+		}
+	}
+}
+
+void ProgressiveRefiner::copyTiles(const ColorBuffer& color) {
+	const int size = DirtyTiles::TILE_SIZE;
+#pragma omp parallel for schedule(dynamic)
+	for (int i = (int)(refined - batch); i < (int)refined; i++) {
+		int x0 = order[i] % tilesX * size, y0 = order[i] / tilesX * size;
+		int x1 = MIN(x0 + size, (int)width), y1 = MIN(y0 + size, (int)height);
+		for (int y = y0; y < y1; y++)
+			std::copy(color(x0, y), color(x1 - 1, y) + 1, (*image)(x0, y));
+	}
+}
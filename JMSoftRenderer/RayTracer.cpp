@@ -0,0 +1,280 @@
+#include "header/RayTracer.h"
+#include "header/Shader.h"
+#include "header/DirtyTiles.h"
+
+#include <omp.h>
+#include <algorithm>
+
+struct RayTracer::Frame {
+	const Scene* scene;
+	int width, height;
+	RGBColor background;
+	float roughness, metallic;
+	int mipLevelOffset;
+	bool shadows;
+	float spreadBase, spreadAngle;	// world space width of a pixel footprint at distance t: spreadBase + t * spreadAngle
+};
+
+struct RayTracer::Surface {
+	Vector3 position;	// offset from the surface towards the camera, origin of the secondary rays
+	Vector3 normal;		// shading normal, turned towards the camera ray
+	Vector3 view;		// towards the camera
+	RGBColor albedo;
+};
+
+namespace {
+	// xorshift, seeded per pixel and sample
+	struct Random {
+		unsigned int state;
+		Random(int x, int y, int sample) : state(((unsigned int)Math::intHashXY(x, y) * 9781u + sample * 6271u) | 1u) {}
+		inline float next() {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return (state >> 8) * (1.0f / 16777216.0f);
+		}
+	};
+
+	// orthonormal tangents of a unit normal (Duff et al. 2017, "Building an Orthonormal Basis, Revisited")
+	inline void Basis(const Vector3& n, Vector3& tangent, Vector3& bitangent) {
+		float sign = n.z >= 0 ? 1.0f : -1.0f;
+		float a = -1.0f / (sign + n.z), b = n.x * n.y * a;
+		tangent = Vector3(1 + sign * n.x * n.x * a, sign * b, -sign * n.x);
+		bitangent = Vector3(b, sign + n.y * n.y * a, -n.y);
+	}
+
+	// camera ray through screen position (sx, sy) from the near to the far plane,
+	// pixel centers at integer coordinates like the rasterizer
+	inline void CameraRay(const Matrix& inverseViewProjection, float sx, float sy, int width, int height,
+		Vector3& origin, Vector3& dir, float& length) {
+		float ndcX = 2.0f * sx / width - 1, ndcY = 1 - 2.0f * sy / height;
+		origin = inverseViewProjection.apply(Vector3(ndcX, ndcY, 0));
+		dir = inverseViewProjection.apply(Vector3(ndcX, ndcY, 1)) - origin;
+		length = dir.length();
+		dir /= length;
+	}
+}
+
+void RayTracer::update(const Scene& scene) {
+	objects.clear();
+	unsigned long long key = DirtyTiles::Hash(scene.model);
+	unsigned int triangleCount = 0;
+	for (auto& instancedMesh : scene.meshes) {
+		const Mesh& mesh = instancedMesh.mesh;
+		if (!mesh.geometry) continue;
+		key = DirtyTiles::Hash(mesh.geometry.get(), key);
+		for (auto& instance : instancedMesh.instances) {
+			objects.push_back({ &mesh, instance.model * scene.model, mesh.color * instance.color, triangleCount });
+			key = DirtyTiles::Hash(objects.back().world, key);
+			triangleCount += (unsigned int)mesh.geometry->triangleCount();
+		}
+	}
+	if (key == buildKey && vertices.size() == triangleCount * 3) return;
+	buildKey = key;
+
+	vertices.resize(triangleCount * 3);
+	for (auto& object : objects) {
+		const MeshGeometry& geometry = *object.mesh->geometry;
+		Vector3* corners = &vertices[object.firstTriangle * 3];
+#pragma omp parallel for schedule(static)
+		for (int i = 0; i < (int)(geometry.triangleCount() * 3); i++)
+			object.world.apply(geometry.positions[geometry.indices[i]], corners[i]);
+	}
+	bvh.build(vertices);
+}
+
+void RayTracer::shadePacket(const Frame& frame, const RayPacket& packet, int pixelX, int pixelY, int sample, RGBColor* colors, float weight) const {
+	const Scene& scene = *frame.scene;
+	Surface surfaces[4];
+	int hits = 0;
+	for (int lane = 0; lane < 4; lane++) {
+		if (packet.tmax[lane] < 0) continue;
+		if (packet.id[lane] < 0) {
+			colors[lane] += frame.background * weight;
+			continue;
+		}
+
+		// the instance and the triangle within its geometry
+		unsigned int id = (unsigned int)packet.id[lane];
+		const Object& object = *(std::upper_bound(objects.begin(), objects.end(), id,
+			[](unsigned int id, const Object& object) { return id < object.firstTriangle; }) - 1);
+		const MeshGeometry& geometry = *object.mesh->geometry;
+		const unsigned int* index = &geometry.indices[(id - object.firstTriangle) * 3];
+		float u = packet.u[lane], v = packet.v[lane], w = 1 - u - v;
+
+		Vector3 dir(packet.dx[lane], packet.dy[lane], packet.dz[lane]);
+		Vector3 position = Vector3(packet.ox[lane], packet.oy[lane], packet.oz[lane]) + dir * packet.tmax[lane];
+		const Vector3* corners = &vertices[id * 3];
+		Vector3 e1 = corners[1] - corners[0], e2 = corners[2] - corners[0];
+		Vector3 geometricNormal = cross(e1, e2);
+		float worldArea = geometricNormal.length();
+		geometricNormal /= MAX(worldArea, 1e-30f);
+		if (geometricNormal.dot(dir) > 0) geometricNormal = -geometricNormal;
+		Vector3 normal = object.world.applyDir(geometry.normals[index[0]] * w + geometry.normals[index[1]] * u + geometry.normals[index[2]] * v);
+		if (normal.lengthSqr() < 1e-30f) normal = geometricNormal;
+		normal.normalize();
+		if (normal.dot(geometricNormal) < 0) normal = -normal;
+
+		Surface& surface = surfaces[lane];
+		surface.albedo = object.color;
+		const MipMap* texture = object.mesh->texture.get();
+		if (texture && !texture->isEmpty()) {
+			// isotropic footprint: the pixel's world space width at the hit, scaled by the triangle's texels per area
+			const Vector2* uv[3] = { &geometry.texCoords[index[0]], &geometry.texCoords[index[1]], &geometry.texCoords[index[2]] };
+			Vector2 texCoord = *uv[0] * w + *uv[1] * u + *uv[2] * v;
+			Vector2 d1 = *uv[1] - *uv[0], d2 = *uv[2] - *uv[0];
+			float uvArea = fabs(d1.x * d2.y - d1.y * d2.x);
+			float footprint = sqrt(uvArea / MAX(worldArea, 1e-30f)) * (frame.spreadBase + frame.spreadAngle * packet.tmax[lane]);
+			surface.albedo *= texture->SampleMipmap(texCoord, Vector2(footprint, 0), Vector2(0, footprint), frame.mipLevelOffset);
+		}
+		float maxCoordinate = MAX(MAX(fabs(position.x), fabs(position.y)), fabs(position.z));
+		surface.position = position + geometricNormal * (1e-4f * (1 + maxCoordinate));
+		surface.normal = normal;
+		surface.view = -dir;
+		hits |= 1 << lane;
+	}
+	if (!hits) return;
+
+	// directional light
+	const DirLight& dirLight = scene.dirLight;
+	RayPacket shadow;
+	float NdotL[4];
+	int lit = 0;
+	for (int lane = 0; lane < 4; lane++) {
+		NdotL[lane] = hits & (1 << lane) ? Math::clamp(surfaces[lane].normal.dot(dirLight.dir)) : 0;
+		if (NdotL[lane] > 0) {
+			shadow.set(lane, surfaces[lane].position, dirLight.dir, Math::Infinity);
+			lit |= 1 << lane;
+		}
+		else shadow.disable(lane);
+	}
+	if (lit && frame.shadows) lit &= ~bvh.occluded(shadow);
+	for (int lane = 0; lane < 4; lane++) {
+		if (!(lit & (1 << lane))) continue;
+		const Surface& surface = surfaces[lane];
+		RGBColor c = surface.albedo;
+		Shader::PhysicallyBasedShading(c, frame.roughness, frame.metallic, surface.normal, dirLight.dir, surface.view, NdotL[lane]);
+		colors[lane] += c * dirLight.color * (dirLight.intensity * NdotL[lane] * weight);
+	}
+
+	// point and spot lights
+	for (auto& light : scene.lights) {
+		Vector3 L[4];
+		float attenuation[4];
+		lit = 0;
+		for (int lane = 0; lane < 4; lane++) {
+			shadow.disable(lane);
+			if (!(hits & (1 << lane))) continue;
+			const Surface& surface = surfaces[lane];
+			Vector3 toLight = light.position - surface.position;
+			float distance = toLight.length();
+			if (distance >= light.range) continue;
+			L[lane] = toLight / MAX(distance, 1e-5f);
+			NdotL[lane] = surface.normal.dot(L[lane]);
+			if (NdotL[lane] <= 0) continue;
+			attenuation[lane] = light.attenuation(L[lane], distance);
+			if (attenuation[lane] <= 0) continue;
+			shadow.set(lane, surface.position, L[lane], distance);
+			lit |= 1 << lane;
+		}
+		if (lit && frame.shadows) lit &= ~bvh.occluded(shadow);
+		for (int lane = 0; lane < 4; lane++) {
+			if (!(lit & (1 << lane))) continue;
+			const Surface& surface = surfaces[lane];
+			RGBColor c = surface.albedo;
+			Shader::PhysicallyBasedShading(c, frame.roughness, frame.metallic, surface.normal, L[lane], surface.view, NdotL[lane]);
+			colors[lane] += c * light.color * (light.intensity * NdotL[lane] * attenuation[lane] * weight);
+		}
+	}
+
+	// environment lighting, darkened by the fraction of cosine distributed rays blocked within aoDistance
+	if (!scene.environment) return;
+	float visibility[4] = { 1, 1, 1, 1 };
+	if (aoSamples > 0) {
+		Vector3 tangent[4], bitangent[4];
+		Random random[4] = { Random(pixelX, pixelY, sample), Random(pixelX + 1, pixelY, sample),
+			Random(pixelX, pixelY + 1, sample), Random(pixelX + 1, pixelY + 1, sample) };
+		int open[4] = { 0, 0, 0, 0 };
+		for (int lane = 0; lane < 4; lane++)
+			if (hits & (1 << lane)) Basis(surfaces[lane].normal, tangent[lane], bitangent[lane]);
+		RayPacket occlusion;
+		for (int k = 0; k < aoSamples; k++) {
+			for (int lane = 0; lane < 4; lane++) {
+				if (!(hits & (1 << lane))) {
+					occlusion.disable(lane);
+					continue;
+				}
+				float phi = 2 * Math::PI * random[lane].next(), r2 = random[lane].next(), r = sqrt(r2);
+				Vector3 dir = tangent[lane] * (r * cos(phi)) + bitangent[lane] * (r * sin(phi)) + surfaces[lane].normal * sqrt(1 - r2);
+				occlusion.set(lane, surfaces[lane].position, dir, aoDistance);
+			}
+			int blocked = bvh.occluded(occlusion);
+			for (int lane = 0; lane < 4; lane++)
+				if (!(blocked & (1 << lane))) open[lane]++;
+		}
+		for (int lane = 0; lane < 4; lane++) visibility[lane] = (float)open[lane] / aoSamples;
+	}
+	for (int lane = 0; lane < 4; lane++) {
+		if (!(hits & (1 << lane))) continue;
+		const Surface& surface = surfaces[lane];
+		colors[lane] += scene.environment->shade(surface.albedo, frame.roughness, frame.metallic, surface.normal, surface.view) * (visibility[lane] * weight);
+	}
+}
+
+void RayTracer::render(const Scene& scene, ColorBuffer& target, const RGBColor& background,
+	float roughness, float metallic, int mipLevelOffset, bool shadows) {
+	update(scene);
+
+	Frame frame;
+	frame.scene = &scene;
+	frame.width = (int)target.get_width();
+	frame.height = (int)target.get_height();
+	frame.background = background;
+	frame.roughness = roughness;
+	frame.metallic = metallic;
+	frame.mipLevelOffset = mipLevelOffset;
+	frame.shadows = shadows;
+	Matrix inverseViewProjection = (scene.view * scene.projection).inverse();
+
+	// footprint of the center pixel, from the ray of its right neighbor
+	Vector3 origin0, dir0, origin1, dir1;
+	float length;
+	CameraRay(inverseViewProjection, frame.width * 0.5f, frame.height * 0.5f, frame.width, frame.height, origin0, dir0, length);
+	CameraRay(inverseViewProjection, frame.width * 0.5f + 1, frame.height * 0.5f, frame.width, frame.height, origin1, dir1, length);
+	frame.spreadBase = (origin1 - origin0).length();
+	frame.spreadAngle = (dir1 - dir0).length();
+
+	int samples = MAX(samplesPerPixel, 1);
+	float weight = 1.0f / samples;
+
+	// one packet per 2x2 pixel block and sample
+#pragma omp parallel for schedule(dynamic)
+	for (int y = 0; y < frame.height; y += 2) {
+		for (int x = 0; x < frame.width; x += 2) {
+			RGBColor colors[4];
+			for (int s = 0; s < samples; s++) {
+				RayPacket packet;
+				Random jitter(x, y, s + samples);
+				for (int lane = 0; lane < 4; lane++) {
+					int px = x + (lane & 1), py = y + (lane >> 1);
+					if (px >= frame.width || py >= frame.height) {
+						packet.disable(lane);
+						continue;
+					}
+					float jx = 0, jy = 0;
+					if (samples > 1) jx = jitter.next() - 0.5f, jy = jitter.next() - 0.5f;
+					Vector3 origin, dir;
+					float rayLength;
+					CameraRay(inverseViewProjection, px + jx, py + jy, frame.width, frame.height, origin, dir, rayLength);
+					packet.set(lane, origin, dir, rayLength);
+				}
+				bvh.intersect(packet);
+				shadePacket(frame, packet, x, y, s, colors, weight);
+			}
+			for (int lane = 0; lane < 4; lane++) {
+				int px = x + (lane & 1), py = y + (lane >> 1);
+				if (px < frame.width && py < frame.height) *target(px, py) = colors[lane];
+			}
+		}
+	}
+}
@@ -0,0 +1,59 @@
+#include "header/ShadingRate.h"
+
+#include <omp.h>
+#include <cstdlib>
+
+namespace {
+	// luminance of a packed RGB color, 0 to 255 in fixed point
+	inline int Luma(int c) {
+		return (((c >> 16) & 0xff) * 77 + ((c >> 8) & 0xff) * 150 + (c & 0xff) * 29) >> 8;
+	}
+}
+
+void ShadingRateImage::resize(int width, int height) {
+	size_t threads = (size_t)omp_get_max_threads();
+	if (width == this->width && height == this->height && scratch.size() == threads) return;
+	if (width != this->width || height != this->height) {
+		this->width = width;
+		this->height = height;
+		tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+		tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+		rates.assign(tilesX * tilesY, 1);
+	}
+	scratch.resize(threads);
+	for (auto& rows : scratch) {
+		rows.steps.resize(tilesX);
+		rows.luma.resize(width);
+		rows.above.resize(width);
+	}
+}
+
+void ShadingRateImage::update(const IntBuffer& image, float maxError) {
+	assert(image.get_width() == width && image.get_height() == height && scratch.size() >= (size_t)omp_get_max_threads());
+	int limit = (int)(maxError * 255);
+
+#pragma omp parallel for schedule(dynamic)
+	for (int ty = 0; ty < tilesY; ty++) {
+		// largest step between horizontal and vertical neighbors within each tile of the row
+		Scratch& rows = scratch[omp_get_thread_num()];
+		vector<int>& steps = rows.steps, & luma = rows.luma, & above = rows.above;
+		std::fill(steps.begin(), steps.end(), 0);
+		int y0 = ty * TILE_SIZE, y1 = MIN(y0 + TILE_SIZE, height);
+		for (int y = y0; y < y1; y++) {
+			const int* pixels = image(0, y);
+			for (int x = 0; x < width; x++) luma[x] = Luma(pixels[x]);
+			for (int x = 0; x < width; x++) {
+				int step = 0;
+				if (x % TILE_SIZE) step = abs(luma[x] - luma[x - 1]);
+				if (y > y0) step = MAX(step, abs(luma[x] - above[x]));
+				int& tile = steps[x / TILE_SIZE];
+				tile = MAX(tile, step);
+			}
+			std::swap(luma, above);
+		}
+
+		unsigned char* rate = &rates[ty * tilesX];
+		for (int tx = 0; tx < tilesX; tx++)
+			rate[tx] = steps[tx] * 4 <= limit ? 4 : steps[tx] * 2 <= limit ? 2 : 1;
+	}
+}
@@ -0,0 +1,327 @@
+#include "header/ShadowCascades.h"
+
+#include <omp.h>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace {
+	const int POISSON_TAPS = 16;
+	const int KERNEL_ROTATIONS = 16;	// one per pixel of a 4x4 block
+	const float MAX_FILTER_RADIUS = 16.0f;	// texels
+
+	const float poissonDisk[POISSON_TAPS][2] = {
+		{ -0.94201624f, -0.39906216f }, { 0.94558609f, -0.76890725f },
+		{ -0.09418410f, -0.92938870f }, { 0.34495938f, 0.29387760f },
+		{ -0.91588581f, 0.45771432f }, { -0.81544232f, -0.87912464f },
+		{ -0.38277543f, 0.27676845f }, { 0.97484398f, 0.75648379f },
+		{ 0.44323325f, -0.97511554f }, { 0.53742981f, -0.47373420f },
+		{ -0.26496911f, -0.41893023f }, { 0.79197514f, 0.19090188f },
+		{ -0.24188840f, 0.99706507f }, { -0.81409955f, 0.91437590f },
+		{ 0.19984126f, 0.78641367f }, { 0.14383161f, -0.14100790f }
+	};
+
+	// the Poisson disk rotated once per 4x4 Bayer index, so each pixel only scales its kernel
+	struct PoissonKernels {
+		alignas(16) float x[KERNEL_ROTATIONS][POISSON_TAPS];
+		alignas(16) float y[KERNEL_ROTATIONS][POISSON_TAPS];
+
+		PoissonKernels() {
+			const int bayer[16] = { 0, 8, 2, 10, 12, 4, 14, 6, 3, 11, 1, 9, 15, 7, 13, 5 };
+			for (int r = 0; r < KERNEL_ROTATIONS; r++) {
+				float angle = bayer[r] * 2.0f * Math::PI / KERNEL_ROTATIONS;
+				float cosA = cos(angle), sinA = sin(angle);
+				for (int t = 0; t < POISSON_TAPS; t++) {
+					x[r][t] = poissonDisk[t][0] * cosA - poissonDisk[t][1] * sinA;
+					y[r][t] = poissonDisk[t][0] * sinA + poissonDisk[t][1] * cosA;
+				}
+			}
+		}
+	};
+	const PoissonKernels poissonKernels;
+
+	inline float HorizontalSum(__m128 v) {
+		alignas(16) float f[4];
+		_mm_store_ps(f, v);
+		return f[0] + f[1] + f[2] + f[3];
+	}
+
+	// stored depths of four taps at (u, v) + kernel * radius, clamped to the map
+	inline __m128 GatherTaps(const FloatBuffer& map, const float* kx, const float* ky, int t,
+		__m128 u, __m128 v, __m128 radius, __m128 maxX, __m128 maxY) {
+		const __m128 zero = _mm_setzero_ps();
+		__m128 x = _mm_min_ps(_mm_max_ps(_mm_add_ps(u, _mm_mul_ps(_mm_load_ps(kx + t), radius)), zero), maxX);
+		__m128 y = _mm_min_ps(_mm_max_ps(_mm_add_ps(v, _mm_mul_ps(_mm_load_ps(ky + t), radius)), zero), maxY);
+		alignas(16) int ix[4], iy[4];
+		_mm_store_si128((__m128i*)ix, _mm_cvttps_epi32(x));
+		_mm_store_si128((__m128i*)iy, _mm_cvttps_epi32(y));
+		const float* data = map();
+		size_t width = map.get_width();
+		return _mm_setr_ps(data[iy[0] * width + ix[0]], data[iy[1] * width + ix[1]],
+			data[iy[2] * width + ix[2]], data[iy[3] * width + ix[3]]);
+	}
+
+	// fraction of the kernel taps whose stored depth is not nearer than z
+	float FilterPCF(const FloatBuffer& map, int rotation, float u, float v, float radius, float z) {
+		const float* kx = poissonKernels.x[rotation], * ky = poissonKernels.y[rotation];
+		__m128 vu = _mm_set1_ps(u), vv = _mm_set1_ps(v), vr = _mm_set1_ps(radius), vz = _mm_set1_ps(z);
+		__m128 maxX = _mm_set1_ps(map.get_width() - 1.0f), maxY = _mm_set1_ps(map.get_height() - 1.0f);
+		__m128 lit = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		for (int t = 0; t < POISSON_TAPS; t += 4) {
+			__m128 d = GatherTaps(map, kx, ky, t, vu, vv, vr, maxX, maxY);
+			lit = _mm_add_ps(lit, _mm_and_ps(_mm_cmpge_ps(d, vz), one));
+		}
+		return HorizontalSum(lit) * (1.0f / POISSON_TAPS);
+	}
+
+	// average depth of the taps nearer than z, false if there are none
+	bool FindBlockers(const FloatBuffer& map, int rotation, float u, float v, float radius, float z, float& blockerDepth) {
+		const float* kx = poissonKernels.x[rotation], * ky = poissonKernels.y[rotation];
+		__m128 vu = _mm_set1_ps(u), vv = _mm_set1_ps(v), vr = _mm_set1_ps(radius), vz = _mm_set1_ps(z);
+		__m128 maxX = _mm_set1_ps(map.get_width() - 1.0f), maxY = _mm_set1_ps(map.get_height() - 1.0f);
+		__m128 sum = _mm_setzero_ps(), count = _mm_setzero_ps();
+		const __m128 one = _mm_set1_ps(1.0f);
+		for (int t = 0; t < POISSON_TAPS; t += 4) {
+			__m128 d = GatherTaps(map, kx, ky, t, vu, vv, vr, maxX, maxY);
+			__m128 blocker = _mm_cmplt_ps(d, vz);
+			sum = _mm_add_ps(sum, _mm_and_ps(blocker, d));
+			count = _mm_add_ps(count, _mm_and_ps(blocker, one));
+		}
+		float n = HorizontalSum(count);
+		if (n == 0) return false;
+		blockerDepth = HorizontalSum(sum) / n;
+		return true;
+	}
+
+	// bilinear sample at texel space (u, v), clamped to the map
+	Vector2 SampleBilinear(const FrameBuffer<Vector2>& map, float u, float v) {
+		float x = MAX(u - 0.5f, 0.0f), y = MAX(v - 0.5f, 0.0f);
+		int maxX = (int)map.get_width() - 1, maxY = (int)map.get_height() - 1;
+		int x0 = MIN((int)x, maxX), y0 = MIN((int)y, maxY);
+		int x1 = MIN(x0 + 1, maxX), y1 = MIN(y0 + 1, maxY);
+		float fx = x - x0, fy = y - y0;
+		const Vector2* row0 = map(0, y0), * row1 = map(0, y1);
+		Vector2 result;
+		result.x = Math::lerp(Math::lerp(row0[x0].x, row0[x1].x, fx), Math::lerp(row1[x0].x, row1[x1].x, fx), fy);
+		result.y = Math::lerp(Math::lerp(row0[x0].y, row0[x1].y, fx), Math::lerp(row1[x0].y, row1[x1].y, fx), fy);
+		return result;
+	}
+}
+
+void ShadowCascades::setResolutions(const vector<size_t>& resolutions) {
+	cascades.resize(resolutions.size());
+	for (size_t i = 0; i < resolutions.size(); i++)
+		if (!cascades[i].depth || cascades[i].depth->get_width() != resolutions[i])
+			cascades[i].depth = make_shared<FloatBuffer>(resolutions[i], resolutions[i]);
+	clear();
+}
+
+void ShadowCascades::clear() {
+	for (auto& cascade : cascades) {
+		cascade.depth->fill(1.0f);
+		cascade.staticValid = cascade.dynamicDrawn = false;
+		cascade.dirty = true;
+	}
+}
+
+bool ShadowCascades::restoreStatic(size_t index, const Matrix& modelViewProjection, unsigned int staticVersion) {
+	ShadowCascade& cascade = cascades[index];
+	if (cascade.staticValid && cascade.staticVersion == staticVersion && cascade.staticMatrix == modelViewProjection) {
+		// the map still holds exactly the static depth unless dynamic casters were added
+		if (cascade.dynamicDrawn) {
+			memcpy((*cascade.depth)(), (*cascade.staticDepth)(), cascade.depth->get_size() * sizeof(float));
+			cascade.dynamicDrawn = false;
+			cascade.dirty = true;
+		}
+		return true;
+	}
+	cascade.depth->fill(1.0f);
+	cascade.staticValid = cascade.dynamicDrawn = false;
+	cascade.dirty = true;
+	return false;
+}
+
+void ShadowCascades::storeStatic(size_t index, const Matrix& modelViewProjection, unsigned int staticVersion) {
+	ShadowCascade& cascade = cascades[index];
+	if (!cascade.staticDepth || cascade.staticDepth->get_width() != cascade.depth->get_width())
+		cascade.staticDepth = make_shared<FloatBuffer>(cascade.depth->get_width(), cascade.depth->get_height());
+	memcpy((*cascade.staticDepth)(), (*cascade.depth)(), cascade.depth->get_size() * sizeof(float));
+	cascade.staticMatrix = modelViewProjection;
+	cascade.staticVersion = staticVersion;
+	cascade.staticValid = true;
+}
+
+void ShadowCascades::beginDynamic(size_t index) {
+	cascades[index].dynamicDrawn = true;
+	cascades[index].dirty = true;
+}
+
+void ShadowCascades::fit(const Matrix& view, const Matrix& projection, float shadowDistance,
+	float splitLambda, const Matrix& lightView, float casterMinZ) {
+	if (cascades.empty()) return;
+
+	// world space corners of the camera near and far planes
+	Matrix invViewProjection = (view * projection).inverse();
+	Vector3 nearCorners[4], farCorners[4];
+	for (int i = 0; i < 4; i++) {
+		float x = i & 1 ? 1.0f : -1.0f, y = i & 2 ? 1.0f : -1.0f;
+		invViewProjection.apply(Vector3(x, y, 0), nearCorners[i]);
+		invViewProjection.apply(Vector3(x, y, 1), farCorners[i]);
+	}
+	float zNear = view.apply(nearCorners[0]).z, zFar = view.apply(farCorners[0]).z;
+	shadowDistance = MIN(shadowDistance, zFar);
+	float logNear = MAX(zNear, 1e-3f);	// orthographic cameras may start at 0
+
+	float sliceNear = zNear;
+	size_t count = cascades.size();
+	for (size_t c = 0; c < count; c++) {
+		ShadowCascade& cascade = cascades[c];
+		float ratio = (float)(c + 1) / count;
+		float logSplit = logNear * pow(shadowDistance / logNear, ratio);
+		float uniformSplit = zNear + (shadowDistance - zNear) * ratio;
+		float sliceFar = Math::lerp(uniformSplit, logSplit, splitLambda);
+
+		// view depth is linear along the frustum edges
+		Vector3 corners[8];
+		Vector3 center;
+		float t0 = (sliceNear - zNear) / (zFar - zNear), t1 = (sliceFar - zNear) / (zFar - zNear);
+		for (int i = 0; i < 4; i++) {
+			corners[i] = nearCorners[i] + (farCorners[i] - nearCorners[i]) * t0;
+			corners[i + 4] = nearCorners[i] + (farCorners[i] - nearCorners[i]) * t1;
+		}
+		for (auto& corner : corners) center += corner * 0.125f;
+		float radius = 0;
+		for (auto& corner : corners) radius = MAX(radius, (corner - center).length());
+		radius = ceil(radius * 16.0f) / 16.0f;
+
+		// snap the map origin to whole texels in light space
+		float texel = 2.0f * radius / cascade.depth->get_width();
+		Vector3 lightCenter = lightView.apply(center);
+		lightCenter.x = floor(lightCenter.x / texel) * texel;
+		lightCenter.y = floor(lightCenter.y / texel) * texel;
+		float zMin = MIN(lightCenter.z - radius, casterMinZ), zMax = lightCenter.z + radius;
+		// coarse steps, so casters moving a little keep the matrices and the static cache valid
+		zMin = floor(zMin * 2.0f / radius) * radius * 0.5f;
+
+		cascade.view = lightView;
+		cascade.view.translate(-lightCenter.x, -lightCenter.y, -zMin);
+		cascade.projection = Matrix().scale(1.0f / radius, 1.0f / radius, 1.0f / (zMax - zMin));
+		cascade.viewProjection = cascade.view * cascade.projection;
+		cascade.splitDepth = sliceFar;
+		cascade.texelSize = texel;
+		cascade.depthRange = zMax - zMin;
+		cascade.depthBias = 2.0f * texel / (zMax - zMin);
+		sliceNear = sliceFar;
+	}
+}
+
+int ShadowCascades::select(float viewDepth) const {
+	for (size_t i = 0; i < cascades.size(); i++)
+		if (viewDepth <= cascades[i].splitDepth) return (int)i;
+	return -1;
+}
+
+void ShadowCascades::prefilter(const ShadowFilterSettings& settings) {
+	if (settings.filter != VSM && settings.filter != ESM) return;
+	int radius = MAX(settings.blurRadius, 0);
+	float weight = 1.0f / (2 * radius + 1);
+	bool exponential = settings.filter == ESM;
+	bool sameSettings = prefiltered.filter == settings.filter && prefiltered.blurRadius == settings.blurRadius
+		&& (!exponential || prefiltered.esmExponent == settings.esmExponent);
+	prefiltered = settings;
+
+	for (auto& cascade : cascades) {
+		if (sameSettings && !cascade.dirty && cascade.moments) continue;
+		cascade.dirty = false;
+		const FloatBuffer& depth = *cascade.depth;
+		int width = (int)depth.get_width(), height = (int)depth.get_height();
+		if (!cascade.moments || cascade.moments->get_width() != depth.get_width())
+			cascade.moments = make_shared<FrameBuffer<Vector2>>(width, height);
+		FrameBuffer<Vector2>& moments = *cascade.moments;
+		blurRows.resize(depth.get_size());
+		momentRows.resize(omp_get_max_threads());
+		for (auto& row : momentRows) row.resize(width);
+
+		// moments of each texel, then a sliding horizontal box sum; the map edge is repeated
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < height; y++) {
+			const float* src = depth(0, y);
+			Vector2* dst = blurRows.data() + (size_t)y * width;
+			for (int x = 0; x < width; x++) {
+				float z = src[x];
+				dst[x] = exponential ? Vector2(exp(settings.esmExponent * z), 0) : Vector2(z, z * z);
+			}
+			vector<Vector2>& row = momentRows[omp_get_thread_num()];
+			std::copy(dst, dst + width, row.begin());
+			Vector2 sum;
+			for (int i = -radius; i <= radius; i++) {
+				const Vector2& m = row[Math::clamp(i, 0, width - 1)];
+				sum.x += m.x;
+				sum.y += m.y;
+			}
+			for (int x = 0; x < width; x++) {
+				dst[x] = Vector2(sum.x * weight, sum.y * weight);
+				const Vector2& add = row[MIN(x + radius + 1, width - 1)], & remove = row[MAX(x - radius, 0)];
+				sum.x += add.x - remove.x;
+				sum.y += add.y - remove.y;
+			}
+		}
+
+		// vertical box blur into the moment map
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < height; y++) {
+			Vector2* dst = moments(0, y);
+			for (int x = 0; x < width; x++) dst[x] = Vector2();
+			for (int i = y - radius; i <= y + radius; i++) {
+				const Vector2* src = blurRows.data() + (size_t)Math::clamp(i, 0, height - 1) * width;
+				for (int x = 0; x < width; x++) {
+					dst[x].x += src[x].x * weight;
+					dst[x].y += src[x].y * weight;
+				}
+			}
+		}
+	}
+}
+
+float ShadowCascades::sample(int index, const Vector3& position, const ShadowFilterSettings& settings, int pixelX, int pixelY) const {
+	const ShadowCascade& cascade = cascades[index];
+	const FloatBuffer& map = *cascade.depth;
+	float u = position.x, v = position.y;
+	if (u < 0 || v < 0 || u >= map.get_width() || v >= map.get_height()) return 1;
+
+	int rotation = (pixelY & 3) * 4 + (pixelX & 3);
+	float z = position.z - cascade.depthBias;
+	switch (settings.filter) {
+	case PCF: {
+		// wider kernels reach further along a sloped receiver
+		float radius = Math::clamp(settings.radius, 0.0f, MAX_FILTER_RADIUS);
+		return FilterPCF(map, rotation, u, v, radius, z - cascade.depthBias * radius);
+	}
+	case PCSS: {
+		// directional light: the penumbra grows with the receiver to blocker distance
+		float worldToTexels = settings.lightSize * cascade.depthRange / cascade.texelSize;
+		float searchRadius = Math::clamp(worldToTexels * position.z, 1.0f, MAX_FILTER_RADIUS);
+		float blockerDepth;
+		if (!FindBlockers(map, rotation, u, v, searchRadius, z - cascade.depthBias * searchRadius, blockerDepth)) return 1;
+		float radius = Math::clamp(worldToTexels * (z - blockerDepth), 1.0f, MAX_FILTER_RADIUS);
+		return FilterPCF(map, rotation, u, v, radius, z - cascade.depthBias * radius);
+	}
+	case VSM: {
+		if (!cascade.moments) break;
+		Vector2 moments = SampleBilinear(*cascade.moments, u, v);
+		if (z <= moments.x) return 1;
+		float variance = MAX(moments.y - moments.x * moments.x, 1e-6f);
+		float d = z - moments.x;
+		float pMax = variance / (variance + d * d);
+		return Math::clamp((pMax - settings.vsmBleedReduction) / (1.0f - settings.vsmBleedReduction));
+	}
+	case ESM: {
+		if (!cascade.moments) break;
+		Vector2 moments = SampleBilinear(*cascade.moments, u, v);
+		return Math::clamp(moments.x * exp(-settings.esmExponent * z));
+	}
+	default:
+		break;
+	}
+	return z > map.get((size_t)u, (size_t)v) ? 0.0f : 1.0f;
+}
@@ -0,0 +1,203 @@
+#include "header/Simplify.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+namespace {
+
+	// symmetric 4x4 matrix of the summed squared plane distances, weighted by area
+	struct Quadric {
+		double a2 = 0, ab = 0, ac = 0, ad = 0;
+		double b2 = 0, bc = 0, bd = 0;
+		double c2 = 0, cd = 0;
+		double d2 = 0;
+		double weight = 0;
+
+		Quadric() {}
+		Quadric(const Vector3& n, float d, double w) {
+			a2 = w * n.x * n.x; ab = w * n.x * n.y; ac = w * n.x * n.z; ad = w * n.x * d;
+			b2 = w * n.y * n.y; bc = w * n.y * n.z; bd = w * n.y * d;
+			c2 = w * n.z * n.z; cd = w * n.z * d;
+			d2 = w * d * d;
+			weight = w;
+		}
+
+		Quadric& operator+=(const Quadric& q) {
+			a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+			b2 += q.b2; bc += q.bc; bd += q.bd;
+			c2 += q.c2; cd += q.cd;
+			d2 += q.d2;
+			weight += q.weight;
+			return *this;
+		}
+
+		// mean squared distance of p to the accumulated planes
+		double evaluate(const Vector3& p) const {
+			double x = p.x, y = p.y, z = p.z;
+			double e = a2 * x * x + b2 * y * y + c2 * z * z + d2
+				+ 2 * (ab * x * y + ac * x * z + bc * y * z + ad * x + bd * y + cd * z);
+			return weight > 0 ? fabs(e) / weight : 0;
+		}
+	};
+
+	struct Collapse {
+		unsigned int from, to;
+		double cost;
+	};
+
+	inline Vector3 faceNormal(const Vector3& a, const Vector3& b, const Vector3& c) {
+		return cross(b - a, c - a);
+	}
+}
+
+shared_ptr<const MeshGeometry> SimplifyMesh(const MeshGeometry& geometry, size_t targetTriangles, float maxError, float* error) {
+	const ArrayView<Vector3>& p = geometry.positions;
+	size_t vertexCount = geometry.vertexCount();
+	vector<unsigned int> indices(geometry.indices.begin(), geometry.indices.end());
+	size_t triangleCount = indices.size() / 3;
+	vector<unsigned char> alive(triangleCount, 1);
+	size_t liveTriangles = triangleCount;
+	double maxCost = (double)maxError * maxError, appliedCost = 0;
+
+	// per vertex quadrics from the incident face planes
+	vector<Quadric> quadrics(vertexCount);
+	for (size_t t = 0; t < triangleCount; t++) {
+		const unsigned int* tri = &indices[t * 3];
+		Vector3 n = faceNormal(p[tri[0]], p[tri[1]], p[tri[2]]);
+		float area = n.length();
+		if (area <= 0) continue;
+		n *= 1.0f / area;
+		Quadric q(n, -n.dot(p[tri[0]]), area);
+		for (int k = 0; k < 3; k++) quadrics[tri[k]] += q;
+	}
+
+	// vertices on edges that are not shared by exactly two triangles are locked
+	vector<unsigned char> locked(vertexCount, 0);
+	{
+		std::unordered_map<uint64_t, int> edges;
+		edges.reserve(indices.size());
+		for (size_t t = 0; t < triangleCount; t++)
+			for (int k = 0; k < 3; k++) {
+				unsigned int a = indices[t * 3 + k], b = indices[t * 3 + (k + 1) % 3];
+				edges[(uint64_t)MIN(a, b) << 32 | MAX(a, b)]++;
+			}
+		for (auto& edge : edges)
+			if (edge.second != 2) {
+				locked[edge.first >> 32] = 1;
+				locked[edge.first & 0xffffffff] = 1;
+			}
+	}
+
+	vector<unsigned int> adjacencyOffset(vertexCount + 1), adjacency;
+	vector<unsigned char> touched(vertexCount);
+	vector<Collapse> collapses;
+	while (liveTriangles > targetTriangles) {
+		// vertex -> live triangles
+		std::fill(adjacencyOffset.begin(), adjacencyOffset.end(), 0);
+		for (size_t t = 0; t < triangleCount; t++)
+			if (alive[t])
+				for (int k = 0; k < 3; k++) adjacencyOffset[indices[t * 3 + k] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++) adjacencyOffset[v + 1] += adjacencyOffset[v];
+		adjacency.resize(adjacencyOffset[vertexCount]);
+		vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+		for (size_t t = 0; t < triangleCount; t++)
+			if (alive[t])
+				for (int k = 0; k < 3; k++) adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+
+		// cheapest collapse of every free vertex into one of its neighbours
+		collapses.clear();
+		for (unsigned int v = 0; v < vertexCount; v++) {
+			if (locked[v]) continue;
+			Collapse best = { v, v, Math::Infinity };
+			for (unsigned int i = adjacencyOffset[v]; i < adjacencyOffset[v + 1]; i++) {
+				const unsigned int* tri = &indices[adjacency[i] * 3];
+				for (int k = 0; k < 3; k++) {
+					if (tri[k] == v) continue;
+					Quadric q = quadrics[v];
+					q += quadrics[tri[k]];
+					double cost = q.evaluate(p[tri[k]]);
+					if (cost < best.cost) best = { v, tri[k], cost };
+				}
+			}
+			if (best.to != v && best.cost <= maxCost) collapses.push_back(best);
+		}
+		if (collapses.empty()) break;
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& a, const Collapse& b) { return a.cost < b.cost; });
+
+		// apply collapses that do not overlap, so adjacency stays valid within the pass
+		std::fill(touched.begin(), touched.end(), 0);
+		size_t applied = 0;
+		for (const Collapse& c : collapses) {
+			if (liveTriangles <= targetTriangles) break;
+			if (touched[c.from] || touched[c.to]) continue;
+
+			// reject collapses that flip or squash a remaining triangle
+			bool valid = true;
+			for (unsigned int i = adjacencyOffset[c.from]; i < adjacencyOffset[c.from + 1] && valid; i++) {
+				const unsigned int* tri = &indices[adjacency[i] * 3];
+				if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) continue;
+				Vector3 moved[3];
+				for (int k = 0; k < 3; k++) moved[k] = p[tri[k] == c.from ? c.to : tri[k]];
+				Vector3 before = faceNormal(p[tri[0]], p[tri[1]], p[tri[2]]);
+				Vector3 after = faceNormal(moved[0], moved[1], moved[2]);
+				if (after.dot(before) <= 0.25f * before.length() * after.length()) valid = false;
+			}
+			if (!valid) continue;
+
+			for (unsigned int i = adjacencyOffset[c.from]; i < adjacencyOffset[c.from + 1]; i++) {
+				unsigned int t = adjacency[i];
+				unsigned int* tri = &indices[t * 3];
+				for (int k = 0; k < 3; k++) {
+					touched[tri[k]] = 1;
+					if (tri[k] == c.from) tri[k] = c.to;
+				}
+				if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2]) {
+					alive[t] = 0;
+					liveTriangles--;
+				}
+			}
+			quadrics[c.to] += quadrics[c.from];
+			appliedCost = MAX(appliedCost, c.cost);
+			applied++;
+		}
+		if (applied == 0) break;
+	}
+
+	// compact the surviving triangles and the vertices they use
+	MeshBuffers buffers;
+	vector<unsigned int> remap(vertexCount, UINT32_MAX);
+	buffers.indices.reserve(liveTriangles * 3);
+	for (size_t t = 0; t < triangleCount; t++) {
+		if (!alive[t]) continue;
+		for (int k = 0; k < 3; k++) {
+			unsigned int v = indices[t * 3 + k];
+			if (remap[v] == UINT32_MAX) {
+				remap[v] = (unsigned int)buffers.positions.size();
+				buffers.positions.push_back(p[v]);
+				buffers.normals.push_back(geometry.normals[v]);
+				buffers.texCoords.push_back(geometry.texCoords[v]);
+			}
+			buffers.indices.push_back(remap[v]);
+		}
+	}
+
+	if (error) *error = (float)sqrt(appliedCost);
+	return MeshGeometry::Create(std::move(buffers));
+}
+
+void GenerateLODs(Mesh& mesh, int levels) {
+	if (!mesh.geometry) return;
+	size_t triangles = mesh.geometry->triangleCount();
+	for (int level = 0; level < levels; level++) {
+		size_t target = triangles / 2;
+		if (target < 16) break;
+
+		// every level starts from the full mesh so errors are measured against the original
+		MeshLOD lod;
+		lod.geometry = SimplifyMesh(*mesh.geometry, target, Math::Infinity, &lod.error);
+		size_t reduced = lod.geometry->triangleCount();
+		if (reduced > triangles * 3 / 4) break;
+		triangles = reduced;
+		mesh.lods.push_back(std::move(lod));
+	}
+}
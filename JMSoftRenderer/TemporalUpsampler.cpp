@@ -0,0 +1,158 @@
+#include "header/TemporalUpsampler.h"
+
+#include <omp.h>
+
+void TemporalUpsampler::resize(size_t width, size_t height) {
+	if (width == this->width && height == this->height) return;
+	this->width = width;
+	this->height = height;
+	history = make_shared<ColorBuffer>(width, height);
+	output = make_shared<ColorBuffer>(width, height);
+	rangeMin = make_shared<ColorBuffer>(get_renderWidth(), get_renderHeight());
+	rangeMax = make_shared<ColorBuffer>(get_renderWidth(), get_renderHeight());
+	valid = false;
+}
+
+void TemporalUpsampler::jitter(int& offsetX, int& offsetY) const {
+	// the diagonal first, so that two consecutive frames already cover the block evenly
+	static const int offsets[4][2] = { { 0, 0 }, { 1, 1 }, { 1, 0 }, { 0, 1 } };
+	offsetX = offsets[frame & 3][0];
+	offsetY = offsets[frame & 3][1];
+}
+
+Matrix TemporalUpsampler::jitteredProjection(const Matrix& projection) const {
+	// Screen position s of the output maps to (s - offset) / 2 in the reduced target. In NDC that
+	// is a scale by k = output size / (2 * target size), 1 for even sizes, and a shift, applied
+	// to clip space through the w column.
+	int offsetX, offsetY;
+	jitter(offsetX, offsetY);
+	float renderWidth = (float)get_renderWidth(), renderHeight = (float)get_renderHeight();
+	float kx = width / (2 * renderWidth), ky = height / (2 * renderHeight);
+	float shiftX = kx - 1 - offsetX / renderWidth, shiftY = 1 - ky + offsetY / renderHeight;
+	Matrix jittered = projection;
+	for (int i = 0; i < 4; i++) {
+		jittered[i][0] = kx * projection[i][0] + shiftX * projection[i][3];
+		jittered[i][1] = ky * projection[i][1] + shiftY * projection[i][3];
+	}
+	return jittered;
+}
+
+static inline RGBColor MinColor(const RGBColor& a, const RGBColor& b) { return RGBColor(MIN(a.r, b.r), MIN(a.g, b.g), MIN(a.b, b.b)); }
+static inline RGBColor MaxColor(const RGBColor& a, const RGBColor& b) { return RGBColor(MAX(a.r, b.r), MAX(a.g, b.g), MAX(a.b, b.b)); }
+
+void TemporalUpsampler::resolve(const ColorBuffer& color, const FloatBuffer& depth, const Matrix& mvp, const Matrix& projection) {
+	int offsetX, offsetY;
+	jitter(offsetX, offsetY);
+	int renderWidth = get_renderWidth(), renderHeight = get_renderHeight();
+	std::swap(history, output);
+
+	// color range of the 3x3 new samples around every sample, shared by the ~4 output pixels nearest
+	// to it: the range of each column of 3, then of 3 neighboring columns
+#pragma omp parallel for schedule(static)
+	for (int Y = 0; Y < renderHeight; Y++) {
+		const RGBColor* above = color(0, MAX(Y - 1, 0));
+		const RGBColor* row = color(0, Y);
+		const RGBColor* below = color(0, MIN(Y + 1, renderHeight - 1));
+		RGBColor* low = (*rangeMin)(0, Y);
+		RGBColor* high = (*rangeMax)(0, Y);
+		RGBColor columnLow[3], columnHigh[3];	// columns X - 1, X, X + 1
+		auto column = [&](int X, int k) {
+			columnLow[k] = MinColor(MinColor(above[X], row[X]), below[X]);
+			columnHigh[k] = MaxColor(MaxColor(above[X], row[X]), below[X]);
+		};
+		column(0, 1);
+		columnLow[0] = columnLow[1], columnHigh[0] = columnHigh[1];
+		for (int X = 0; X < renderWidth; X++) {
+			column(MIN(X + 1, renderWidth - 1), 2);
+			low[X] = MinColor(MinColor(columnLow[0], columnLow[1]), columnLow[2]);
+			high[X] = MaxColor(MaxColor(columnHigh[0], columnHigh[1]), columnHigh[2]);
+			columnLow[0] = columnLow[1], columnHigh[0] = columnHigh[1];
+			columnLow[1] = columnLow[2], columnHigh[1] = columnHigh[2];
+		}
+	}
+
+	// Reprojection from the current clip space to the previous one, through object space. The clip
+	// position of output pixel (x, y) is w * (ndcX, ndcY, P22, 1) + (0, 0, P32, 0) for a perspective
+	// projection (w from rhw), (ndcX, ndcY, z, 1) for an orthographic one, and (ndcX, ndcY, 1, 1) on
+	// the far plane where nothing was drawn, so each row only adds ndcX * R0 to a common base.
+	Matrix R = Matrix(mvp).inverse() * previousMVP;
+	bool perspective = projection[3][3] == 0;
+	float P22 = projection[2][2], P32 = projection[3][2];
+
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < (int)height; y++) {
+		RGBColor* out = (*output)(0, y);
+		// reduced target rows around the pixel: Y0 and Y0 + 1 for interpolation, the nearest for the color range
+		int Y0 = (y - offsetY) >> 1;
+		int Yc = Math::clamp((y - offsetY + 1) >> 1, 0, renderHeight - 1);
+		float fy = ((y - offsetY) & 1) * 0.5f;
+		const RGBColor* colorRows[2] = { color(0, Math::clamp(Y0, 0, renderHeight - 1)), color(0, Math::clamp(Y0 + 1, 0, renderHeight - 1)) };
+		const float* depthRows[2] = { depth(0, Math::clamp(Y0, 0, renderHeight - 1)), depth(0, Math::clamp(Y0 + 1, 0, renderHeight - 1)) };
+		const RGBColor* lowRow = (*rangeMin)(0, Yc);
+		const RGBColor* highRow = (*rangeMax)(0, Yc);
+		bool sampledRow = ((y - offsetY) & 1) == 0 && Y0 >= 0 && Y0 < renderHeight;
+		float ndcY = 1 - 2.0f * y / height, rowBase[4];
+		for (int i = 0; i < 4; i++) rowBase[i] = ndcY * R[1][i] + R[3][i];
+
+		for (int x = 0; x < (int)width; x++) {
+			int X0 = (x - offsetX) >> 1;
+			int Xc = Math::clamp((x - offsetX + 1) >> 1, 0, renderWidth - 1);
+			float fx = ((x - offsetX) & 1) * 0.5f;
+			int columns[2] = { Math::clamp(X0, 0, renderWidth - 1), Math::clamp(X0 + 1, 0, renderWidth - 1) };
+			bool sampled = sampledRow && ((x - offsetX) & 1) == 0 && X0 >= 0 && X0 < renderWidth;
+
+			// flat neighborhood (most of the background): the clamp leaves no choice
+			const RGBColor& low = lowRow[Xc], & high = highRow[Xc];
+			if (low.r == high.r && low.g == high.g && low.b == high.b) {
+				out[x] = low;
+				continue;
+			}
+
+			// the new sample, or without one a bilinear estimate from the nearest new samples
+			auto current = [&]() {
+				if (sampled) return colorRows[0][X0];
+				return (colorRows[0][columns[0]] * (1 - fx) + colorRows[0][columns[1]] * fx) * (1 - fy) +
+					(colorRows[1][columns[0]] * (1 - fx) + colorRows[1][columns[1]] * fx) * fy;
+			};
+			if (!valid) {
+				out[x] = current();
+				continue;
+			}
+
+			// reproject with the nearest depth around the pixel, so that edges follow the foreground
+			float nearest = MAX(MAX(depthRows[0][columns[0]], depthRows[0][columns[1]]), MAX(depthRows[1][columns[0]], depthRows[1][columns[1]]));
+			float ndcX = 2.0f * x / width - 1, clipPos[4];
+			float w = nearest > 0 ? 1 / nearest : 0;
+			for (int i = 0; i < 4; i++) {
+				float c = rowBase[i] + ndcX * R[0][i];
+				if (nearest <= 0) clipPos[i] = c + R[2][i];
+				else if (perspective) clipPos[i] = (c + P22 * R[2][i]) * w + P32 * R[2][i];
+				else clipPos[i] = c + R[2][i] * w;
+			}
+			float hx = -1, hy = -1;
+			if (clipPos[3] > 1e-6f) {
+				float rw = 1 / clipPos[3];
+				hx = (clipPos[0] * rw + 1) * width * 0.5f;
+				hy = (1 - clipPos[1] * rw) * height * 0.5f;
+			}
+			if (!(hx >= 0 && hy >= 0 && hx <= width - 1 && hy <= height - 1)) {
+				out[x] = current();
+				continue;
+			}
+
+			// bilinear history, clamped to the color range of the new samples around the pixel
+			int hx0 = MIN((int)hx, (int)width - 2), hy0 = MIN((int)hy, (int)height - 2);
+			float tx = hx - hx0, ty = hy - hy0;
+			const RGBColor* h0 = (*history)(hx0, hy0);
+			const RGBColor* h1 = (*history)(hx0, hy0 + 1);
+			RGBColor previous = (h0[0] * (1 - tx) + h0[1] * tx) * (1 - ty) + (h1[0] * (1 - tx) + h1[1] * tx) * ty;
+			previous = MinColor(MaxColor(previous, low), high);
+
+			out[x] = sampled ? previous + (colorRows[0][X0] - previous) * sampleWeight : previous;
+		}
+	}
+
+	previousMVP = mvp;
+	valid = true;
+	frame++;
+}
@@ -0,0 +1,41 @@
+#include "header/WeightedBlendedOIT.h"
+
+#include <omp.h>
+
+void WeightedBlendedOIT::resize(size_t width, size_t height) {
+	if (width == this->width && height == this->height) return;
+	this->width = width;
+	this->height = height;
+	accumColor = make_shared<ColorBuffer>(width, height);
+	accumAlpha = make_shared<FloatBuffer>(width, height);
+	revealage = make_shared<FloatBuffer>(width, height);
+}
+
+void WeightedBlendedOIT::clear() {
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < (int)height; y++) {
+		RGBColor* color = (*accumColor)(0, y);
+		float* alpha = (*accumAlpha)(0, y);
+		float* reveal = (*revealage)(0, y);
+		for (size_t x = 0; x < width; x++) {
+			color[x] = RGBColor();
+			alpha[x] = 0;
+			reveal[x] = 1;
+		}
+	}
+}
+
+void WeightedBlendedOIT::composite(ColorBuffer& target) const {
+	assert(target.get_width() >= width && target.get_height() >= height);
+#pragma omp parallel for schedule(static)
+	for (int y = 0; y < (int)height; y++) {
+		const RGBColor* color = (*accumColor)(0, y);
+		const float* alpha = (*accumAlpha)(0, y);
+		const float* reveal = (*revealage)(0, y);
+		RGBColor* out = target(0, y);
+		for (size_t x = 0; x < width; x++) {
+			if (reveal[x] >= 1) continue;
+			out[x] = color[x] * ((1 - reveal[x]) / MAX(alpha[x], 1e-5f)) + out[x] * reveal[x];
+		}
+	}
+}
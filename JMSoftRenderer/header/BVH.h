@@ -0,0 +1,70 @@
+#pragma once
+
+#include "../Core/Vector.h"
+#include "Primitives.h"
+
+#include <xmmintrin.h>
+#include <emmintrin.h>
+
+// 4 rays in SoA layout, traced together with SSE. Lanes with a negative tmax are inactive.
+struct RayPacket {
+	alignas(16) float ox[4], oy[4], oz[4];	// origins
+	alignas(16) float dx[4], dy[4], dz[4];	// directions, not necessarily normalized
+	alignas(16) float tmax[4];				// ray length in units of the direction, the closest hit after intersect()
+	alignas(16) int id[4];					// hit triangle (index at build time), -1 for none
+	alignas(16) float u[4], v[4];			// barycentric coordinates of the hit, weights of the 2nd and 3rd vertex
+
+	inline void set(int lane, const Vector3& origin, const Vector3& dir, float length) {
+		ox[lane] = origin.x, oy[lane] = origin.y, oz[lane] = origin.z;
+		dx[lane] = dir.x, dy[lane] = dir.y, dz[lane] = dir.z;
+		tmax[lane] = length;
+		id[lane] = -1;
+		u[lane] = v[lane] = 0;
+	}
+	inline void disable(int lane) {
+		set(lane, Vector3(), Vector3(0, 0, 1), -1.0f);
+	}
+};
+
+// Bounding volume hierarchy over world space triangles. The build bins triangle centroids
+// (surface area heuristic over BINS buckets per axis) and processes the tree level by level:
+// wide levels split their nodes in parallel, the few large nodes at the top bin their
+// triangles in parallel instead. Nodes close to the traversal stack limit split at the median,
+// which bounds the depth however skewed the triangles are. Traversal tests the 4 rays of a
+// packet against each node and triangle at once, descending into a node as long as any of
+// them hits its box.
+class BVH {
+public:
+	static const int BINS = 16;
+	static const int MAX_LEAF = 4;		// leaves this small are never split
+
+	struct Node {
+		float min[3], max[3];
+		unsigned int index;		// first child of an inner node (the other is index + 1), first triangle of a leaf
+		unsigned short count;	// triangles of a leaf, 0 for inner nodes
+		unsigned short axis;	// split axis of an inner node, visits the near child first
+	};
+
+private:
+	struct Triangle { Vector3 v0, e1, e2; };
+	vector<Node> nodes;
+	vector<Triangle> triangles;		// in leaf order
+	vector<unsigned int> ids;		// build time index of each triangle
+	int maxDepth = 0;				// of the deepest leaf, the root is at 0
+
+	struct Split;
+	// bounds and split of the count triangles listed in order, binning them in parallel if asked
+	Split findSplit(const vector<AABB>& bounds, const vector<Vector3>& centroids, const unsigned int* order, unsigned int count, bool parallel);
+
+public:
+	// vertices holds 3 consecutive corners per triangle
+	void build(const vector<Vector3>& vertices);
+	inline bool isEmpty() const { return triangles.empty(); }
+	inline size_t nodeCount() const { return nodes.size(); }
+	inline int depth() const { return maxDepth; }
+
+	// closest hit of every active ray within its tmax
+	void intersect(RayPacket& packet) const;
+	// bit i set when ray i hits anything within its tmax (shadow and occlusion rays)
+	int occluded(const RayPacket& packet) const;
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "../Core/Matrix.h"
+#include "Primitives.h"
+
+// Plane n.p + d = 0, n points to the inside
+struct Plane {
+	Vector3 n;
+	float d;
+
+	inline float distance(const Vector3& p) const { return n.dot(p) + d; }
+};
+
+enum CullResult {
+	Outside,
+	Intersect,
+	Inside
+};
+
+// The six clip planes of a model-view-projection matrix, in the space the matrix
+// transforms from (so a mesh can be tested with its own object space bounds).
+struct Frustum {
+	Plane planes[6];
+
+	Frustum() {}
+	Frustum(const Matrix& mvp);
+
+	CullResult test(const BoundingSphere& sphere) const;
+};
+
+// Where the view rays come from, in the same space as the tested bounds.
+// Perspective views have an eye point, orthographic views a constant direction.
+struct ViewOrigin {
+	Vector3 eye;
+	Vector3 dir;
+	bool orthographic;
+
+	ViewOrigin() {}
+	ViewOrigin(const Matrix& modelView, const Matrix& projection);
+
+	// true when every triangle of the meshlet faces away from the view
+	bool isBackfacing(const Meshlet& meshlet) const;
+};
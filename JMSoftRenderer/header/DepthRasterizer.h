@@ -0,0 +1,38 @@
+#pragma once
+
+#include "FrameBuffer.h"
+#include "Primitives.h"
+
+// Depth-only triangle rasterizer for shadow maps. Triangles are queued from any thread,
+// binned into screen tiles and rasterized tile-parallel with SSE edge functions,
+// interpolating nothing but z. The target keeps the smallest z (nearest).
+class DepthRasterizer {
+private:
+	struct DepthTriangle {
+		float x[3], y[3];
+		float z0, dzdx, dzdy;	// z = z0 + dzdx * (x - x[0]) + dzdy * (y - y[0])
+		int minX, minY, maxX, maxY;
+	};
+
+	// triangles and their tile bins, one set per OpenMP thread so queueing needs no locks
+	struct ThreadQueue {
+		vector<DepthTriangle> triangles;
+		vector<vector<unsigned int>> bins;
+	};
+
+	vector<ThreadQueue> queues;
+	int width = 0, height = 0, tilesX = 0, tilesY = 0;
+
+	void rasterizeTriangle(FloatBuffer& target, const DepthTriangle& tri, int tileX0, int tileY0, int tileX1, int tileY1);
+
+public:
+	DepthRasterizer() {}
+
+	// start queueing triangles for a target of the given size
+	void begin(int width, int height);
+	// screen space vertices (x, y in pixels, z in [0, 1]), counter-clockwise triangles
+	// (positive area in y-down screen space) are kept. Thread safe.
+	void addTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2);
+	// rasterize everything queued since begin() into target
+	void flush(FloatBuffer& target);
+};
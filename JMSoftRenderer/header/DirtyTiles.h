@@ -0,0 +1,66 @@
+#pragma once
+
+#include "../Core/Matrix.h"
+
+// Screen tiles to re-render when most of the image is unchanged since the previous frame.
+// Every frame the pipeline lists its drawables (mesh instances, lights, and one entry for the
+// global state) in the same order, each with a hash of everything that affects its pixels and a
+// conservative screen rectangle. A drawable whose hash changed dirties both its previous and its
+// current rectangle; a different number of drawables dirties the whole screen.
+class DirtyTiles {
+public:
+	static const int TILE_SIZE = 32;	// pixels
+
+	struct Rect {
+		int x0 = 0, y0 = 0, x1 = -1, y1 = -1;	// inclusive pixel bounds, empty when x0 > x1
+		inline bool isEmpty() const { return x0 > x1 || y0 > y1; }
+	};
+
+private:
+	struct Item {
+		unsigned long long hash;
+		Rect rect;
+	};
+	vector<Item> items, previousItems;
+	vector<unsigned char> tiles;	// 1 for dirty, row major
+	int width = 0, height = 0, tilesX = 0, tilesY = 0;
+	bool all = true;				// the whole screen is dirty
+	bool clean = false;				// no tile is dirty
+	bool valid = false;				// previousItems describe the image kept from the last frame
+
+	void mark(const Rect& rect);
+
+public:
+	// start listing the drawables of a frame rendered to a width x height target
+	void begin(int width, int height);
+	inline void add(unsigned long long hash, const Rect& rect) { items.push_back({ hash, rect }); }
+	// compare the listed drawables with the previous frame and mark the dirty tiles
+	void finish();
+	// forget the previous frame, the next one is dirty everywhere
+	inline void invalidate() { valid = false; }
+	// after finish(), replace the dirty tiles by the given tile indices (row major)
+	void select(const int* indices, size_t count);
+
+	inline bool isAll() const { return all; }
+	inline bool isClean() const { return clean; }
+	inline int get_tilesX() const { return tilesX; }
+	inline int get_tilesY() const { return tilesY; }
+	inline bool isDirty(int tileX, int tileY) const { return tiles[tileY * tilesX + tileX] != 0; }
+	// dirty flags of the tiles in pixel row y
+	inline const unsigned char* tileRow(int y) const { return &tiles[(y / TILE_SIZE) * tilesX]; }
+	// whether any tile under rect is dirty
+	bool touches(const Rect& rect) const;
+
+	inline Rect fullScreen() const { return Rect{ 0, 0, width - 1, height - 1 }; }
+	// conservative pixel bounds of a world space sphere swept along sweep (e.g. to cover its shadow),
+	// the whole screen when it reaches behind the camera
+	Rect projectSphere(const Vector3& center, float radius, const Matrix& viewProjection, const Vector3& sweep = Vector3()) const;
+
+	// FNV-1a over the bytes of value, chained through seed
+	template <class T>
+	static inline unsigned long long Hash(const T& value, unsigned long long seed = 14695981039346656037ull) {
+		const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&value);
+		for (size_t i = 0; i < sizeof(T); i++) seed = (seed ^ bytes[i]) * 1099511628211ull;
+		return seed;
+	}
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+// Cube map, one face per axis direction in the order +X -X +Y -Y +Z -Z
+struct CubeMap {
+	shared_ptr<ColorBuffer> faces[6];
+
+	CubeMap(size_t size = 1) {
+		for (auto& face : faces) face = make_shared<ColorBuffer>(size, size);
+	}
+
+	inline size_t size() const { return faces[0]->get_width(); }
+
+	// unnormalized direction through face coordinates u, v in [-1, 1] (v points down)
+	static Vector3 direction(int face, float u, float v);
+	// bilinear sample along a direction, clamped at the face edges
+	RGBColor sample(const Vector3& dir) const;
+};
+
+// Image based lighting from an equirectangular HDR environment, prefiltered for the split
+// sum approximation: diffuse irradiance as 9 SH coefficients, specular radiance as a cube map
+// mip chain with increasing GGX roughness, and a shared (NdotV, roughness) BRDF lookup table.
+class Environment {
+public:
+	vector<CubeMap> specular;	// mip i is prefiltered for roughness i / (levels - 1)
+	RGBColor irradianceSH[9];	// cosine convolved radiance, evaluate with irradiance()
+	float intensity = 1.0f;
+
+	RGBColor irradiance(const Vector3& n) const;
+	// trilinear lookup of the prefiltered radiance in direction r
+	RGBColor radiance(const Vector3& r, float roughness) const;
+
+	// Ambient light reflected towards V, with the material model of Shader::PhysicallyBasedShading.
+	// N and V are normalized.
+	RGBColor shade(const RGBColor& baseColor, float roughness, float metallic, const Vector3& N, const Vector3& V) const;
+};
+
+// Load an equirectangular .hdr image and precompute its lighting (in parallel).
+// specularSize is the face size of the sharpest specular mip, nullptr on failure.
+shared_ptr<Environment> LoadEnvironment(const char* filename, size_t specularSize = 128);
+
+// (scale, bias) of F0 in the split sum specular integral, indexed by (NdotV, roughness)
+const FrameBuffer<Vector2>& SplitSumBRDF();
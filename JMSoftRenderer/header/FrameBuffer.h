@@ -12,6 +12,7 @@ protected:
 	size_t size;
 	float aspect;
 	T* buffer;
+	bool ownsBuffer = true;
 
 public:
 	FrameBuffer(size_t width = 2, size_t height = 2) :
@@ -21,8 +22,15 @@ public:
 		aspect((float)width / height) {
 		buffer = new T[size];
 	}
+	// ʹⲿڴ(, Ҳͷ)
+	FrameBuffer(size_t width, size_t height, T* external) :
+		width(width), height(height),
+		texelSizeX(1.0f / width), texelSizeY(1.0f / height),
+		size(width* height),
+		aspect((float)width / height),
+		buffer(external), ownsBuffer(false) {}
 	~FrameBuffer() {
-		delete[] buffer;
+		if (ownsBuffer) delete[] buffer;
 	}
 
 	inline size_t get_width() const { return width; }
@@ -48,6 +56,8 @@ public:
 
 	T* operator()(size_t index = 0) { return buffer + index; }
 	T* operator()(size_t x, size_t y) { return buffer + (y * width + x); }
+	const T* operator()(size_t index = 0) const { return buffer + index; }
+	const T* operator()(size_t x, size_t y) const { return buffer + (y * width + x); }
 
 	// x, y [0, 1)Χ
 	inline T get(float x, float y) const {
@@ -94,6 +104,9 @@ private:
 
 public:
 	MipMap() { maps.clear(); maps.push_back(nullptr); }
+	MipMap(vector<shared_ptr<IntBuffer>> levels) : maps(std::move(levels)) {
+		if (maps.empty()) maps.push_back(nullptr);
+	}
 	MipMap(shared_ptr<IntBuffer>& buffer) {
 		maps.clear();
 		maps.push_back(buffer);
@@ -106,7 +119,7 @@ public:
 	}
 	~MipMap() {}
 
-	inline RGBColor& SampleMipmap(Vector2& uv, Vector2& dx, Vector2& dy, int levelOffset = 0) {
+	inline RGBColor SampleMipmap(const Vector2& uv, const Vector2& dx, const Vector2& dy, int levelOffset = 0) const {
 		/*
 		float px = maps[0]->get_texelSizeX() * (abs(dx.x) + abs(dx.y));
 		float py = maps[0]->get_texelSizeY() * (abs(dy.x) + abs(dy.y));
@@ -121,7 +134,8 @@ public:
 		//return RGBColor().setRGBInt(maps[lod]->tex2D(uv.x, uv.y));
 		return RGBColor((lod - 1.0f)*0.5f);
 	}
-	inline bool isEmpty() { return maps[0] == nullptr; }
+	inline bool isEmpty() const { return maps[0] == nullptr; }
+	inline const vector<shared_ptr<IntBuffer>>& get_levels() const { return maps; }
 	//IntBuffer& operator[](size_t mipmapLevel) { return maps[Math::clamp(mipmapLevel, 0, 4)]; }
 };
 
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../Core/Matrix.h"
+#include "Primitives.h"
+#include "Scene.h"
+
+// Clustered light culling (Forward+): the view frustum is divided into screen tiles and
+// exponential depth slices, and every cluster lists the point/spot lights whose bounding
+// spheres reach it. Shading then loops only over the lights of its own cluster.
+class LightClusters {
+private:
+	int tilesX = 0, tilesY = 0;
+	int width = 0, height = 0;
+	float zNear = 0, zFar = 1, sliceScale = 0, sliceBias = 0;
+	vector<unsigned int> offsets;		// per cluster start in indices, clusterCount + 1 entries
+	vector<unsigned short> indices;		// light indices of all clusters back to back
+
+	inline int clusterIndex(int tileX, int tileY, int slice) const { return (slice * tilesY + tileY) * tilesX + tileX; }
+
+public:
+	static const int TILE_SIZE = 32;	// pixels
+	static const int SLICES = 16;		// exponentially spaced between the near and far planes
+
+	LightClusters() {}
+
+	// assign lights to the clusters of a width x height target seen through view and projection
+	void build(const vector<PunctualLight>& lights, const Matrix& view, const Matrix& projection, int width, int height);
+
+	inline bool empty() const { return indices.empty(); }
+
+	// lights of the cluster holding pixel (x, y) at a camera view depth
+	inline const unsigned short* lights(int x, int y, float viewDepth, unsigned int& count) const {
+		int slice = viewDepth <= 0 ? 0 : Math::clamp((int)(log(viewDepth) * sliceScale + sliceBias), 0, SLICES - 1);
+		int tileX = Math::clamp(x / TILE_SIZE, 0, tilesX - 1), tileY = Math::clamp(y / TILE_SIZE, 0, tilesY - 1);
+		int cluster = clusterIndex(tileX, tileY, slice);
+		count = offsets[cluster + 1] - offsets[cluster];
+		return indices.data() + offsets[cluster];
+	}
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "../Core/Define.h"
+
+// Read-only memory mapping of a whole file.
+// The mapping stays valid for the lifetime of the object.
+class MappedFile {
+private:
+	const char* data = nullptr;
+	size_t size = 0;
+	void* fileHandle = nullptr;		// HANDLE on windows, fd otherwise
+	void* mappingHandle = nullptr;
+
+	void close();
+
+public:
+	MappedFile() {}
+	MappedFile(const char* filename) { open(filename); }
+	~MappedFile() { close(); }
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(const char* filename);
+
+	inline bool isOpen() const { return data != nullptr; }
+	inline const char* get_data() const { return data; }
+	inline size_t get_size() const { return size; }
+};
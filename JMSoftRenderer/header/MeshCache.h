@@ -0,0 +1,11 @@
+#pragma once
+
+#include "Primitives.h"
+
+// Load an .obj through a binary cache stored next to it ("<objPath>.jmc").
+// The cache holds the SoA vertex streams, index buffers, meshlets and bounds of every mesh,
+// lodLevels simplified LODs per mesh (see GenerateLODs) and the mip chain of texturePath,
+// and is rebuilt whenever a source file or lodLevels changes.
+// Loaded meshes (and their texture levels) point straight into the memory mapped cache,
+// so later loads cost almost nothing and read-only pages are shared between processes.
+bool LoadMeshCached(const char* objPath, vector<Mesh>& meshes, const char* texturePath = nullptr, int lodLevels = 0);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "Primitives.h"
+
+// Load a Wavefront .obj file, one Mesh per "o"/"g"/"usemtl" group.
+// The file is memory mapped and parsed in parallel chunks, and identical
+// position/uv/normal tuples are merged into a single vertex.
+// Polygons are fan triangulated; faces without normals get smoothed vertex normals.
+bool LoadOBJ(const char* filename, vector<Mesh>& meshes);
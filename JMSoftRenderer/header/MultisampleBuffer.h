@@ -0,0 +1,53 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+// Color and depth target with 2, 4 or 8 samples per pixel (MSAA). Depth is kept per sample,
+// color is kept compressed: while every sample of a pixel holds the same color (the usual case
+// away from triangle edges) only one color per pixel is written and read, and resolve() copies it
+// as is. A pixel is expanded to per sample colors when a triangle covers only part of it.
+class MultisampleBuffer {
+private:
+	shared_ptr<FloatBuffer> depth;		// width * samples x height, sample s of pixel x at x * samples + s
+	shared_ptr<ColorBuffer> pixelColor;		// width x height (HDR), the color of compressed pixels
+	shared_ptr<ColorBuffer> sampleColor;	// same layout as depth, valid in expanded pixels only
+	vector<unsigned char> compressed;	// per pixel
+	size_t width = 0, height = 0;
+	int samples = 1;
+
+public:
+	// sample offsets from the pixel position, the standard D3D patterns for 2, 4 and 8 samples
+	static const Vector2* pattern(int samples);
+
+	inline int get_samples() const { return samples; }
+	inline size_t get_width() const { return width; }
+	inline size_t get_height() const { return height; }
+	inline float* depthRow(int y) { return (*depth)(0, y); }
+
+	// reallocates only when the size or sample count changes
+	void resize(size_t width, size_t height, int samples);
+	void clear(const RGBColor& clearColor, float clearDepth);
+
+	// write c to the samples of pixel (x, y) set in mask
+	inline void write(int x, int y, unsigned int mask, const RGBColor& c) {
+		unsigned char& packed = compressed[(size_t)y * width + x];
+		unsigned int coverage = (1u << samples) - 1;
+		if (mask == coverage) {
+			(*pixelColor)(x, y)[0] = c;
+			packed = 1;
+			return;
+		}
+		RGBColor* colors = (*sampleColor)(0, y) + (size_t)x * samples;
+		if (packed) {
+			RGBColor pixel = (*pixelColor)(x, y)[0];
+			for (int s = 0; s < samples; s++) colors[s] = pixel;
+			packed = 0;
+		}
+		for (int s = 0; s < samples; s++)
+			if (mask & (1u << s)) colors[s] = c;
+	}
+
+	// average the samples of every pixel into target (of the same size),
+	// and optionally store the farthest sample depth of every pixel for later single sampled passes
+	void resolve(ColorBuffer& target, FloatBuffer* farthestDepth = nullptr) const;
+};
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "../Core/Matrix.h"
+#include "FrameBuffer.h"
+#include "Primitives.h"
+
+// Low resolution depth buffer of designated occluders, used to reject meshes and
+// meshlets before they are transformed. Stores normalized depth z/w (smaller is nearer).
+// Occluder triangles only cover pixels they fully contain and are written at their
+// farthest depth, so the buffer never claims more occlusion than really exists.
+class OcclusionBuffer {
+private:
+	// occluder triangle in buffer pixels, counter-clockwise after setup
+	struct OccluderTriangle {
+		float x[3], y[3];
+		float z;
+		int minY, maxY;
+	};
+
+	FloatBuffer depth;
+	vector<OccluderTriangle> triangles;
+	int width, height;
+
+	void rasterizeRows(int y0, int y1);
+
+public:
+	// width is rounded up to a multiple of 4 for the SSE loops
+	OcclusionBuffer(size_t width, size_t height);
+
+	inline bool isEmpty() const { return triangles.empty(); }
+
+	void clear();
+	// queue the triangles of an occluder for rasterize()
+	void addOccluder(const MeshGeometry& geometry, const Matrix& mvp);
+	void rasterize();
+
+	// true if the box (in the space mvp transforms from) is hidden behind rasterized occluders
+	bool isOccluded(const AABB& box, const Matrix& mvp) const;
+};
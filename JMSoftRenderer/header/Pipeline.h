@@ -4,6 +4,20 @@
 #include "FrameBuffer.h"
 #include "Primitives.h"
 #include "Scene.h"
+#include "Culling.h"
+#include "OcclusionBuffer.h"
+#include "ShadowCascades.h"
+#include "DepthRasterizer.h"
+#include "LightClusters.h"
+#include "MultisampleBuffer.h"
+#include "PostProcess.h"
+#include "WeightedBlendedOIT.h"
+#include "DirtyTiles.h"
+#include "TemporalUpsampler.h"
+#include "ShadingRate.h"
+#include "ProgressiveRefiner.h"
+#include "RayTracer.h"
+#include "Shader.h"
 
 #include <omp.h>
 
@@ -13,52 +27,220 @@ enum ProjectionMethod
 	Orthogonal
 };
 
+// ͸(AlphaBlend)MeshĻƷʽ
+enum TransparencyMode
+{
+	SortedBlend,	// ʵӿռȴԶ, ƬԪ
+	WeightedOIT		// Ȩϵ˳޹͸(), Ҫ
+};
+
 class Pipeline {
 public:
 	bool enableShadow;
+	bool enableCulling = true;	// MeshMeshlet׶/޳
+	bool enableLOD = true;		// ĻߴѡLOD
+	float lodErrorPixels = 1.0f;	// LODĻ()
+	bool enableOcclusion = true;	// ڵ޳סMeshMeshlet
+	float shadowDistance = 10.0f;	// Ӱǵӿռ
+	float cascadeSplitLambda = 0.75f;	// : 0Ϊ, 1Ϊ
+	ShadowFilterSettings shadowFilter;	// Ӱ˷ʽ(Hard/PCF/PCSS/VSM/ESM)
+	bool enableShadowCache = true;	// 澲̬MeshӰ, ֻػ̬Mesh
 	int mipmapLevelOffset = 0;
 	float roughness = 0.0f, metallic = 0.0f;
+	ShadingQuality shadingQuality = ShadingQuality::FastMath;	// BRDF: οʵ/ѧ/
+	int msaaSamples = 1;	// زݵĲ(1Ϊر, 2/4/8), ÿֻɫһ, ´clearBuffersЧ
+	ToneMapper toneMapper;		// HDRrenderBufferɫӳ/Gamma/, renderMeshesʱһ
+	bool enableFXAA = false;	// renderMeshesʱrenderBufferFXAA(MSAA)
+	TransparencyMode transparencyMode = SortedBlend;
+	bool enableIncremental = false;	// ֻػб仯Ļֿ, һ֡ɫ(MSAAʱЧ)
+	bool enableTemporal = false;	// ÿһķֱȾ, ͶӰһ֡ŴrenderBuffer(Ԥ, ʱMSAAȾ)
+	bool enableVRS = false;			// ɱɫ: һ֡ƽķֿÿ2x24x4ֻɫһ, (MSAAʱϲʱЧ)
+	float vrsMaxError = 0.05f;		// VRSĿ(0~1), ԽԽԽģ
+	bool enableProgressive = false;	// ʽȾ: 仯ʱ1/4Ԥ, ֹĻĿʼϸȫֱ(MSAAȾ)
+	int progressiveTilesPerFrame = 64;	// ϸʱÿ֡Ⱦȫֱʷֿ(DirtyTiles::TILE_SIZE)
+	bool enableRayTracing = false;	// ù׷ٴդͬһ(οͼ), ӰAOɹ󽻵õ, ʱȾģʽ
+	RayTracer rayTracer;			// ׷ٵBVH/AO
 
 private:
 	////          Buffer          ////
 	IntBuffer& renderBuffer;	// Ⱦ
+	ColorBuffer hdrBuffer;		// (HDR)ɫ, ƬԪֱд벻ض
 	FloatBuffer ZBuffer;        // Z Buffer
-	FloatBuffer shadowBuffer;   // light space Z Buffer
+	MultisampleBuffer multisampleBuffer;	// MSAA(ѹ)ɫ, renderMeshesʱhdrBuffer
+	ShadowCascades shadowCascades;	// light space Z Buffer, ÿһ
+	DepthRasterizer depthRasterizer;	// ӰPassֻдȹդ
+	OcclusionBuffer occlusionBuffer;	// ͷֱڵ(Ⱦֱʵ1/4)
+	LightClusters lightClusters;		// ÿĻֿ鼰ƬڵĵԴ/۹б
+	VisibilityLUT visibilityLUT;		// ǰֲڶȵĿɼұ(FastLUT)
+	WeightedBlendedOIT oitBuffer;		// WeightedOITۻ
+	FXAA fxaa;							// ݼluma
+	DirtyTiles dirtyTiles;				// ȾʱҪػĻֿ
+	TemporalUpsampler temporalUpsampler;	// ʱϲʷ֡, ͷֱʱhdrBufferZBufferֻϽ
+	ShadingRateImage shadingRates;		// VRSÿֿɫ, һ֡ͼõ
+	ProgressiveRefiner progressiveRefiner;	// ʽȾͼֿϸ˳
 
 	////          ǰȾ          ////
 	ProjectionMethod projectionMethod = ProjectionMethod::Perspective;
 
 	////       ǰȾ״̬       ////
-	MipMap currentTexture;						// ǰMeshʹõ
-	ShadeFunc currentShadeFunc;									// ǰMeshʹõɫ
+	const MeshGeometry* currentGeometry = nullptr;				// ǰMeshļ
+	bool currentOcclusion = false;								// ǰPassǷڵ޳
+	FloatBuffer* currentShadowBuffer = nullptr;					// ǰȾļӰͼ
+	bool depthOnlyPass = false;									// ǰPassֻд(Ӱ)
+	bool multisampling = false;									// ֡ǷȾmultisampleBuffer
+	bool temporal = false;										// ֡ǷԽ͵ķֱȾʱϲ
+	bool progressive = false;									// ֡Ƿ񽥽ʽȾ(Ԥϸ)
+	int mipBias = 0;											// ͷֱȾʱѡmip
+	bool coarseShading = false;									// ֡ǷshadingRatesɫ
+	const MipMap* currentTexture = nullptr;					// ǰMeshʹõ
+	const MeshShader* currentShader = nullptr;					// ǰMeshʹõɫ
 	RGBColor currentColor;										// ǰMeshɫ
-	void (Pipeline::* currentRasterizeScanlineFunc)(Scanline&);	// ǰɨ߹դָ
+	BlendMode currentBlend = Opaque;							// ǰMeshĻϷʽ
+	float currentOpacity = 1.0f, currentAlphaCutoff = 0.5f;
+	RGBColor clearColor;										// ֡ıɫ
+	bool scissorTiles = false;									// ֻդֿڵ
+	const unsigned char* currentInstanceMask = nullptr;			// ǰMeshҪƵʵ, Ϊʱȫ
+
+	Matrix _matrix_M, _matrix_V, _matrix_P, _matrix_VP, _matrix_MVP;
 
-	Matrix _matrix_M, _matrix_V, _matrix_P, _matrix_VP, _matrix_MVP, _matrix_light_VP;
 	Vector3 cameraPos;
 	DirLight dirLight;
+	const vector<PunctualLight>* lights = nullptr;
+	const Environment* environment = nullptr;
+
+	////       ʵεĶ任       ////
+	static const size_t INSTANCE_BATCH_VERTICES = 1 << 16;		// ÿ任Ķ
+	vector<Matrix> batchMatrix_M, batchMatrix_MVP;				// ÿʵľ
+	vector<RGBColor> batchColor;								// ÿʵɫ
+	vector<Vector4> clipPosCache;
+	vector<Vector3> worldPosCache, worldNormalCache;
+	vector<unsigned char> vertexVisible, meshletVisible;		// δ޳ĶMeshlet
+	vector<std::pair<unsigned int, unsigned int>> visibleMeshlets;	// (ʵ, Meshlet)
+	vector<vector<unsigned int>> lodInstances;					// ÿLODѡеʵ
+	struct alignas(16) VaryingRegister { float lanes[4]; };	// 4float, ͬ__m128
+	vector<VaryingRegister> varyingCache;						// ÿvaryings(׶)
+
+	////       ͸Pass       ////
+	static const int BLEND_BAND_ROWS = 16;						// ͸ΰִйդ
+	struct TransparentInstance { float depth; unsigned int mesh, instance; };
+	vector<TransparentInstance> transparentOrder;				// Զİ͸ʵ
+	vector<unsigned int> sortedInstances;						// ͬһMeshڵһʵ
+	vector<unsigned int> meshletTriangleOffset;					// ÿɼMeshlet׸triangleRowsеλ
+	vector<std::pair<int, int>> triangleRows;					// ÿɼθǵзΧ
+
+	////       Ⱦ       ////
+	vector<DirtyTiles::Rect> instanceRects;						// Meshʵ, ӰĻΧ
+	vector<unsigned char> instanceDirty;						// ͬ, Ӱ췶ΧֿΪ1
+	vector<size_t> meshInstanceOffset;							// ÿMesh׸ʵinstanceDirtyеλ
+
+	////       ɱɫ       ////
+	// ȿɫ, Ͻǵx, ֻͬһ(stamp)ͬһڸ
+	struct CoarseSample { unsigned int stamp; int row; bool shaded; RGBAColor color; };
+	struct CoarseCache { vector<CoarseSample> samples; unsigned int stamp = 0; };
+	vector<CoarseCache> coarseCaches;							// ÿ߳һ, ÿstampһ
+
+	////          ɫ          ////
+	// ׼PBRɫ: Ӱ, , Դ/۹뻷, shading()
+	// ֵֻõ: 뷨, ʱټ
+	template <bool TEXTURED>
+	struct StandardShader {
+		static const int VARYINGS = TEXTURED ? 8 : 6;
+		static const int TEXCOORD = TEXTURED ? 6 : -1;
+		Pipeline* pipeline;
+
+		inline void vertex(const VertexInput& in, Varyings<VARYINGS>& out) const {
+			out.set(0, in.worldPos);
+			out.set(3, in.normal);
+			if constexpr (TEXTURED) out.set(6, in.texCoord);
+		}
+		inline bool fragment(const Varyings<VARYINGS>& in, const FragmentInput& frag, RGBAColor& out) const {
+			Vector2 texCoord;
+			if constexpr (TEXTURED) texCoord = in.vector2(6);
+			pipeline->shading(in.vector3(0), in.vector3(3), frag.color, texCoord, frag, out.rgb);
+			out.alpha = 1.0f;
+			return true;
+		}
+	};
+	ShaderProgram<StandardShader<false>> standardShader;			// δָɫMeshʹ
+	ShaderProgram<StandardShader<true>> standardTexturedShader;	// δָɫMeshʹ
+	template <class S> friend class ShaderProgram;
 
 
 	int targetWidth;
 	int targetHeight;
 
 
-	// դɨ
-	void rasterizeScanline(Scanline& scanline);
-	// դɨߣshadowMap汾
-	void rasterizeShadowMap(Scanline& scanline);
+	// ɫSеǰοɼĶ׶, ٹդɼMeshlet
+	template <class S>
+	void drawShaded(const S& shader, const MeshGeometry& geometry);
+	// դɨ, صƬԪ׶
+	template <class S>
+	void rasterizeScanline(const S& shader, const Scanline<TVertex<S::VARYINGS>>& scanline, FragmentInput& frag);
 	// и(Ϊƽκƽ)
-	void triangleSpilt(SplitedTriangle& st, const TVertex* v0, const TVertex* v1, const TVertex* v2);
-	// yֵƽףתΪɨ
-	void rasterizeTriangle(const SplitedTriangle& st);
-	// һα任üɨ
-	void renderTriangle(const Vertex* v[3]);
-	void shading(TVertex& v, RGBColor& c, Vector2& dx, Vector2& dy);
+	template <class V>
+	void triangleSpilt(SplitedTriangle<V>& st, const V* v0, const V* v1, const V* v2);
+	// yֵƽףתΪɨ, ֻ[rowMin, rowMax]ڵ
+	template <class S>
+	void rasterizeTriangle(const S& shader, const SplitedTriangle<TVertex<S::VARYINGS>>& st, FragmentInput& frag, int rowMin, int rowMax);
+	// MSAAդ: ĸȲ, ÿֻһƬԪ׶
+	template <class S>
+	void rasterizeTriangleMultisample(const S& shader, const TVertex<S::VARYINGS>* tv, FragmentInput& frag);
+	// һβüɨ, varyingsΪ׶ε, ͸Passֻդ[rowMin, rowMax]ڵ
+	template <class S>
+	void renderTriangle(const S& shader, const Varyings<S::VARYINGS>* varyings, const unsigned int* index, size_t vertexBase, const RGBColor& color,
+		int rowMin = 0, int rowMax = std::numeric_limits<int>::max());
+	// ֻдȵ(ӰPass), depthRasterizerֿդ
+	void renderDepthTriangle(const unsigned int* index, size_t vertexBase);
+	// դеڵ
+	void renderOccluders(const Scene& scene);
+	// һʵMeshMeshlet޳, ǿɼMeshlet䶥
+	void cullMeshlets(const MeshGeometry& geometry, size_t instanceCount);
+	// 任һʵпɼĶ㵽
+	void transformVertices(const MeshGeometry& geometry, size_t instanceCount, bool withAttributes);
+	// ͶӰѡLOD, 0Ϊԭʼ
+	int selectLOD(const Mesh& mesh, const Matrix& world);
+	// LODһMeshʵ(renderMeshesrenderShadowMap)
+	// orderΪʱеʵ˳(͸)
+	void drawMesh(const InstancedMesh& mesh, const Matrix& model, const vector<unsigned int>* order = nullptr);
+	// ڲ͸Mesh֮AlphaBlendMesh
+	void renderTransparent(const Scene& scene);
+	// Ⱦ: һ֡Ƚϳ, ǲֿ, ҳҪػʵ
+	void updateDirtyTiles(const Scene& scene);
+	// dirtyTilesг֡ȫ״̬, ʵԴ, ¼ʵĻΧ
+	void listDrawables(const Scene& scene);
+	// ҳӰ췶Χֿʵ, ֿ鲢ֿü
+	void clearDirtyTiles();
+	// ʽȾ: б仯ʱлͷֱʵԤtrue, ѡձ֡ϸķֿ
+	bool updateProgressive(const Scene& scene);
+	// ͷֱȾʱֻõϽ
+	void clearTopLeft(int width, int height) {
+#pragma omp parallel for schedule(static)
+		for (int y = 0; y < height; y++) {
+			std::fill(hdrBuffer(0, y), hdrBuffer(0, y) + width, clearColor);
+			std::fill(ZBuffer(0, y), ZBuffer(0, y) + width, 0.0f);
+		}
+	}
+	// ͬһΰλѡеʵ
+	void drawInstances(const MeshGeometry& geometry, const vector<Instance>& instances,
+		const vector<unsigned int>& selected, const Matrix& model);
+	// ׼ɫƬԪ׶, fragתӰ˺
+	void shading(const Vector3& worldPos, Vector3 N, const RGBColor& color, const Vector2& texCoord, const FragmentInput& frag, RGBColor& c);
+	// shadingQualityһԴBRDF, cΪɫ
+	void shadeBRDF(RGBColor& c, const Vector3& N, const Vector3& L, const Vector3& V, float NdotL);
+
+	// ͸ƬԪ: Ľ, ۻOIT
+	inline void blendFragment(RGBColor& dst, int x, int y, const RGBAColor& c, float viewDepth) {
+		float alpha = Math::clamp(c.alpha * currentOpacity);
+		if (transparencyMode == WeightedOIT)
+			oitBuffer.add(x, y, c.rgb, alpha, viewDepth);
+		else
+			dst = dst * (1 - alpha) + c.rgb * alpha;
+	}
 
 	// ص(Խ)
 	inline void drawPixel(int x, int y, const RGBColor& color) {
 		if (x >= 0 && x < targetWidth && y >= 0 && y < targetHeight)
-			renderBuffer.set(x, y, color.toRGBInt());
+			hdrBuffer.set(x, y, color);
 		else
 			printf("drawPixel() Out of bound!");
 	}
@@ -90,22 +272,408 @@ public:
 		renderBuffer(renderBuffer),
 		targetWidth((int)renderBuffer.get_width()),
 		targetHeight((int)renderBuffer.get_height()),
+		hdrBuffer(renderBuffer.get_width(), renderBuffer.get_height()),
 		ZBuffer(renderBuffer.get_width(),
 			renderBuffer.get_height()),
-		shadowBuffer(shadowMapSize, shadowMapSize),
+		shadowCascades(vector<size_t>(3, shadowMapSize)),
+		occlusionBuffer(renderBuffer.get_width() / 4, renderBuffer.get_height() / 4),
 		projectionMethod(method),
-		currentRasterizeScanlineFunc(&Pipeline::rasterizeScanline),
+		standardShader(StandardShader<false>{ this }),
+		standardTexturedShader(StandardShader<true>{ this }),
 		enableShadow(enableShadow) {}
 	~Pipeline() {}
 
 	void clearBuffers(RGBColor clearColor) {
-		this->renderBuffer.fill(clearColor.toRGBInt());
+		this->clearColor = clearColor;
+		if (enableRayTracing) {// hdrBufferɹ׷帲
+			temporal = progressive = multisampling = false;
+			dirtyTiles.invalidate();
+			return;
+		}
+		temporal = enableTemporal;
+		bool wasProgressive = progressive;
+		progressive = enableProgressive && !temporal;
+		multisampling = msaaSamples > 1 && !temporal && !progressive;
+		if (progressive != wasProgressive) dirtyTiles.invalidate();// ʽȾʱֻвַֿЧ
+		if (progressive) progressiveRefiner.resize(renderBuffer.get_width(), renderBuffer.get_height());
+		if ((enableIncremental || progressive) && !multisampling && !temporal) return;// renderMeshesֻֿ
+		dirtyTiles.invalidate();
+		if (temporal) {// ֻսͷֱʺõϽ
+			temporalUpsampler.resize(renderBuffer.get_width(), renderBuffer.get_height());
+			clearTopLeft(temporalUpsampler.get_renderWidth(), temporalUpsampler.get_renderHeight());
+			return;
+		}
 		this->ZBuffer.fill(0.0f);
-		this->shadowBuffer.fill(0.0f);
+		if (multisampling) {// hdrBufferɽ帲
+			multisampleBuffer.resize(renderBuffer.get_width(), renderBuffer.get_height(), msaaSamples);
+			multisampleBuffer.clear(clearColor, 0.0f);
+		}
+		else
+			this->hdrBuffer.fill(clearColor);
+		// ӰͼrenderShadowMapָ
 	}
 
 	void setProjectionMethod(ProjectionMethod method) { this->projectionMethod = method; }
+	// ÿӰͼķֱ, (2~4)
+	void setShadowCascades(const vector<size_t>& resolutions) { shadowCascades.setResolutions(resolutions); }
 
 	void renderMeshes(const Scene& scene);
 	void renderShadowMap(const Scene& scene);
 };
+
+
+template <class S>
+void ShaderProgram<S>::draw(Pipeline& pipeline, const MeshGeometry& geometry) const { pipeline.drawShaded(shader, geometry); }
+
+template <class S>
+void Pipeline::drawShaded(const S& shader, const MeshGeometry& geometry) {
+	typedef Varyings<S::VARYINGS> VaryingsS;
+	size_t vertexCount = geometry.vertexCount();
+	int total = (int)(vertexCount * batchColor.size());
+	size_t registers = (size_t)total * (VaryingsS::PACKED / 4);
+	if (varyingCache.size() < registers)
+		varyingCache.resize(registers);
+	VaryingsS* varyings = reinterpret_cast<VaryingsS*>(varyingCache.data());
+
+	// ׶, ֻδ޳Ķ
+#pragma omp parallel for schedule(static)
+	for (int i = 0; i < total; i++) {
+		if (!vertexVisible[i]) continue;
+		size_t instance = i / vertexCount, v = i % vertexCount;
+		varyings[i] = VaryingsS();
+		shader.vertex(VertexInput{ worldPosCache[i], worldNormalCache[i], geometry.texCoords[v], batchColor[instance] }, varyings[i]);
+	}
+
+	if (currentBlend != AlphaBlend) {
+#pragma omp parallel for schedule(dynamic)
+		for (int i = 0; i < (int)visibleMeshlets.size(); i++) {
+			size_t instance = visibleMeshlets[i].first;
+			const Meshlet& meshlet = geometry.meshlets[visibleMeshlets[i].second];
+			const unsigned int* index = &geometry.indices[meshlet.firstIndex];
+			for (unsigned int t = 0; t < meshlet.triangleCount; t++)
+				renderTriangle(shader, varyings, index + t * 3, instance * vertexCount, batchColor[instance]);
+		}
+		return;
+	}
+
+	// ͸Ļ˳й: Ļзִ, ÿһ̰߳ύ˳դཻ֮,
+	// ûдͻ, ڱԶ˳. ÿθǵзΧ
+	meshletTriangleOffset.resize(visibleMeshlets.size() + 1);
+	meshletTriangleOffset[0] = 0;
+	for (size_t i = 0; i < visibleMeshlets.size(); i++)
+		meshletTriangleOffset[i + 1] = meshletTriangleOffset[i] + geometry.meshlets[visibleMeshlets[i].second].triangleCount;
+	triangleRows.resize(meshletTriangleOffset.back());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < (int)visibleMeshlets.size(); i++) {
+		size_t vertexBase = visibleMeshlets[i].first * vertexCount;
+		const Meshlet& meshlet = geometry.meshlets[visibleMeshlets[i].second];
+		const unsigned int* index = &geometry.indices[meshlet.firstIndex];
+		for (unsigned int t = 0; t < meshlet.triangleCount; t++) {
+			float minY = Math::Infinity, maxY = -Math::Infinity;
+			bool behind = false;
+			for (int k = 0; k < 3; k++) {
+				const Vector4& clipPos = clipPosCache[vertexBase + index[t * 3 + k]];
+				if (clipPos.w <= 0) behind = true;
+				float y = (1.0f - clipPos.y / clipPos.w) * targetHeight * 0.5f;
+				minY = MIN(minY, y);
+				maxY = MAX(maxY, y);
+			}
+			triangleRows[meshletTriangleOffset[i] + t] = behind ? std::make_pair(0, targetHeight) : std::make_pair((int)minY, (int)maxY + 1);
+		}
+	}
+
+	int bands = (targetHeight + BLEND_BAND_ROWS - 1) / BLEND_BAND_ROWS;
+#pragma omp parallel for schedule(dynamic)
+	for (int band = 0; band < bands; band++) {
+		int rowMin = band * BLEND_BAND_ROWS, rowMax = MIN(rowMin + BLEND_BAND_ROWS, targetHeight) - 1;
+		for (size_t i = 0; i < visibleMeshlets.size(); i++) {
+			size_t instance = visibleMeshlets[i].first;
+			const Meshlet& meshlet = geometry.meshlets[visibleMeshlets[i].second];
+			const unsigned int* index = &geometry.indices[meshlet.firstIndex];
+			const std::pair<int, int>* rows = &triangleRows[meshletTriangleOffset[i]];
+			for (unsigned int t = 0; t < meshlet.triangleCount; t++)
+				if (rows[t].first <= rowMax && rows[t].second >= rowMin)
+					renderTriangle(shader, varyings, index + t * 3, instance * vertexCount, batchColor[instance], rowMin, rowMax);
+		}
+	}
+}
+
+template <class S>
+void Pipeline::rasterizeScanline(const S& shader, const Scanline<TVertex<S::VARYINGS>>& scanline, FragmentInput& frag) {
+	if (scanline.y < 0 || scanline.y >= targetHeight) return;
+	RGBColor* fbPtr = hdrBuffer(0, scanline.y);
+	float* zbPtr = ZBuffer(0, scanline.y);
+	int x0 = MAX(scanline.x0, 0), x1 = MIN(scanline.x1, targetWidth - 1);
+	TVertex<S::VARYINGS> vi = scanline.v0;
+	RGBAColor c;
+	frag.y = scanline.y;
+	const unsigned char* dirtyRow = scissorTiles ? dirtyTiles.tileRow(scanline.y) : nullptr;
+	// Alpha Testĸؾ, ɫ
+	const unsigned char* rateRow = coarseShading && currentBlend != AlphaTest ? shadingRates.row(scanline.y) : nullptr;
+	CoarseCache* cache = rateRow ? &coarseCaches[omp_get_thread_num()] : nullptr;
+
+	for (int x = x0; x <= x1; x++) {
+		// ͸ͶӰȽrhwֱӱȽ
+		float rhw = projectionMethod == ProjectionMethod::Perspective ? vi.rhw : 1.0f / vi.point.z;
+		float rhw_inv = 1.0f / rhw;
+		if (rhw >= zbPtr[x] && (!dirtyRow || dirtyRow[x / DirtyTiles::TILE_SIZE])) {  // Ƚ, Ⱦʱδ仯ķֿ
+			frag.x = x;
+			if constexpr (S::TEXCOORD >= 0) {
+				frag.dx = scanline.dx * rhw_inv;
+				frag.dy = scanline.dy * rhw_inv;
+			}
+			bool shaded;
+			int rate = rateRow ? rateRow[x / ShadingRateImage::TILE_SIZE] : 1;
+			if (rate > 1) {// ͬһrate x rateĿֻɫһ
+				CoarseSample& sample = cache->samples[x & -rate];
+				int row = scanline.y / rate;
+				if (sample.stamp != cache->stamp || sample.row != row) {
+					sample.shaded = shader.fragment(vi.varyings * rhw_inv, frag, sample.color);
+					sample.stamp = cache->stamp;
+					sample.row = row;
+				}
+				shaded = sample.shaded;
+				c = sample.color;
+			}
+			else
+				shaded = shader.fragment(vi.varyings * rhw_inv, frag, c);// Բֵָ
+			if (shaded) {
+				if (currentBlend == AlphaBlend)
+					blendFragment(fbPtr[x], x, scanline.y, c, rhw_inv);
+				else if (currentBlend == Opaque || c.alpha * currentOpacity >= currentAlphaCutoff) {
+					fbPtr[x] = c.rgb;
+					zbPtr[x] = rhw;
+				}
+			}
+		}
+		vi += scanline.step;// ֲֵÿ
+	}
+}
+
+template <class S>
+void Pipeline::rasterizeTriangle(const S& shader, const SplitedTriangle<TVertex<S::VARYINGS>>& st, FragmentInput& frag, int rowMin, int rowMax) {
+	typedef TVertex<S::VARYINGS> V;
+	typedef SplitedTriangle<V> Triangle;
+	// Ļϵı仯, ѡmipmap
+	auto texCoord = [](const V& v) {
+		if constexpr (S::TEXCOORD >= 0) return v.varyings.vector2(S::TEXCOORD);
+		else return Vector2();
+	};
+
+	if (st.type & Triangle::FLAT_TOP) {
+		int y0 = (int)st.bottom.point.y + 1;
+		int y1 = (int)st.left.point.y;
+		float yl = st.left.point.y - st.bottom.point.y;
+		auto median_left = Math::lerp(st.left, st.bottom, 0.5),
+			median_right = Math::lerp(st.right, st.bottom, 0.5);
+		auto dx = (texCoord(median_right) - texCoord(median_left)) / (fabs(median_right.point.x - median_left.point.x) + 1);
+		auto dy = (Math::lerp(texCoord(st.left), texCoord(st.right), 0.5) - texCoord(st.bottom)) / (abs(y1 - y0) + 1);
+
+		for (int y = MAX(y0, rowMin); y <= MIN(y1, rowMax); y++) {
+			float factor = (y - st.bottom.point.y) / yl;
+			V left = Math::lerp(st.bottom, st.left, factor);
+			V right = Math::lerp(st.bottom, st.right, factor);
+			Scanline<V> scanline;
+			scanline.x0 = (int)left.point.x;
+			scanline.x1 = (int)right.point.x;
+			scanline.y = y;
+			scanline.dx = dx;
+			scanline.dy = dy;
+			scanline.v0 = left;
+			scanline.step = (right - left) * (1.0f / (right.point.x - left.point.x));
+			rasterizeScanline(shader, scanline, frag);
+		}
+	}
+	if (st.type & Triangle::FLAT_BOTTOM) {
+		int y0 = (int)st.left.point.y + 1;
+		int y1 = (int)st.top.point.y;
+		float yl = st.top.point.y - st.left.point.y;
+		auto median_left = Math::lerp(st.left, st.top, 0.5),
+			median_right = Math::lerp(st.right, st.top, 0.5);
+		auto dx = (texCoord(median_right) - texCoord(median_left)) / (fabs(median_right.point.x - median_left.point.x) + 1);
+		auto dy = (Math::lerp(texCoord(st.left), texCoord(st.right), 0.5) - texCoord(st.top)) / (abs(y1 - y0) + 1);
+
+		for (int y = MAX(y0, rowMin); y <= MIN(y1, rowMax); y++) {
+			float factor = (y - st.left.point.y) / yl;
+			V left = Math::lerp(st.left, st.top, factor);
+			V right = Math::lerp(st.right, st.top, factor);
+			Scanline<V> scanline;
+			scanline.x0 = (int)left.point.x;
+			scanline.x1 = (int)right.point.x;
+			scanline.y = y;
+			scanline.dx = dx;
+			scanline.dy = dy;
+			scanline.v0 = left;
+			scanline.step = (right - left) * (1.0f / (right.point.x - left.point.x));
+			rasterizeScanline(shader, scanline, frag);
+		}
+	}
+}
+
+template <class V>
+void Pipeline::triangleSpilt(SplitedTriangle<V>& st, const V* v0, const V* v1, const V* v2) {
+	// ζ㰴Yv0 <= v1 <= v2
+	if (v0->point.y > v1->point.y) swap(v0, v1);
+	if (v0->point.y > v2->point.y) swap(v0, v2);
+	if (v1->point.y > v2->point.y) swap(v1, v2);
+
+	// жι
+	if (Math::isZero(v0->point.y - v1->point.y) && Math::isZero(v1->point.y - v2->point.y) ||
+		Math::isZero(v0->point.x - v1->point.x) && Math::isZero(v1->point.x - v2->point.x)) {
+		st.type = SplitedTriangle<V>::NONE;
+		return;
+	}
+
+	if (Math::isZero(v0->point.y - v1->point.y)) { // ױYȣƽΣ
+		assert(v2->point.y > v0->point.y);
+		if (v0->point.x > v1->point.x) swap(v0, v1);
+
+		st.top = *v2;
+		st.left = *v0;
+		st.right = *v1;
+		st.type = SplitedTriangle<V>::FLAT_BOTTOM;
+		return;
+	}
+	else if (Math::isZero(v1->point.y - v2->point.y)) { // YȣƽΣ
+		assert(v2->point.y > v0->point.y);
+		if (v1->point.x > v2->point.x) swap(v1, v2);
+
+		st.bottom = *v0;
+		st.left = *v1;
+		st.right = *v2;
+		st.type = SplitedTriangle<V>::FLAT_TOP;
+		return;
+	}
+
+	st.top = *v2;
+	st.bottom = *v0;
+	st.type = SplitedTriangle<V>::FLAT_TOP_BOTTOM;
+
+	float factor = (v1->point.y - v0->point.y) / (v2->point.y - v0->point.y);
+	V splitV = Math::lerp(st.bottom, st.top, factor);
+
+	if (splitV.point.x <= v1->point.x) {
+		st.left = splitV;
+		st.right = *v1;
+	}
+	else {
+		st.left = *v1;
+		st.right = splitV;
+	}
+}
+
+template <class S>
+void Pipeline::renderTriangle(const S& shader, const Varyings<S::VARYINGS>* varyings, const unsigned int* index, size_t vertexBase, const RGBColor& color,
+	int rowMin, int rowMax) {
+	Vector4 clipPos[3];
+	Vector3 screenPos[3];
+	for (size_t i = 0; i < 3; i++)
+		clipPos[i] = clipPosCache[vertexBase + index[i]];
+	for (size_t i = 0; i < 3; i++)
+		transformHomogenize(clipPos[i], screenPos[i], targetWidth, targetHeight);
+
+	// cvvüȫĻȾ
+	int cvv[3] = { checkCVV(clipPos[0]), checkCVV(clipPos[1]), checkCVV(clipPos[2]) };
+	if (cvv[0] > 0 && cvv[1] > 0 && cvv[2] > 0) return;
+	// ü
+	if (cross(screenPos[1] - screenPos[0], screenPos[2] - screenPos[1]).z <= 0)
+		return;
+
+	// varyings1/w, ʹĻռԲֵ͸ӽ
+	TVertex<S::VARYINGS> tv[3];
+	for (size_t i = 0; i < 3; i++) {
+		tv[i].point = screenPos[i];
+		tv[i].rhw = 1.0f / clipPos[i].w;
+		tv[i].varyings = varyings[vertexBase + index[i]] * tv[i].rhw;
+	}
+	FragmentInput frag{ 0, 0, Vector2(), Vector2(), color, currentTexture, mipmapLevelOffset + mipBias };
+	// ͸Passز, ȡʱԶ
+	if (multisampling && currentBlend != AlphaBlend) {
+		rasterizeTriangleMultisample(shader, tv, frag);
+		return;
+	}
+	if (coarseShading) coarseCaches[omp_get_thread_num()].stamp++;
+	SplitedTriangle<TVertex<S::VARYINGS>> st;
+	triangleSpilt(st, &tv[0], &tv[1], &tv[2]);
+	rasterizeTriangle(shader, st, frag, rowMin, rowMax);
+}
+
+template <class S>
+void Pipeline::rasterizeTriangleMultisample(const S& shader, const TVertex<S::VARYINGS>* tv, FragmentInput& frag) {
+	typedef TVertex<S::VARYINGS> V;
+	const int samples = multisampleBuffer.get_samples();
+	const Vector2* offsets = MultisampleBuffer::pattern(samples);
+	const bool perspective = projectionMethod == ProjectionMethod::Perspective;
+
+	// ߺE(x, y) = A x + B y + C, i붥i, ڲΪ
+	float A[3], B[3], C[3];
+	for (int i = 0; i < 3; i++) {
+		const Vector3& a = tv[(i + 1) % 3].point, & b = tv[(i + 2) % 3].point;
+		A[i] = a.y - b.y;
+		B[i] = b.x - a.x;
+		C[i] = a.x * b.y - a.y * b.x;
+	}
+	float area = A[0] * tv[0].point.x + B[0] * tv[0].point.y + C[0];
+	if (area <= 0) return;
+
+	// rhw˹rhwvaryingsĻռ, ݶȵõÿص
+	float invArea = 1.0f / area;
+	V ddx = tv[0] * (A[0] * invArea) + tv[1] * (A[1] * invArea) + tv[2] * (A[2] * invArea);
+	V ddy = tv[0] * (B[0] * invArea) + tv[1] * (B[1] * invArea) + tv[2] * (B[2] * invArea);
+
+	// 0.5
+	float minX = MIN(tv[0].point.x, MIN(tv[1].point.x, tv[2].point.x)), maxX = MAX(tv[0].point.x, MAX(tv[1].point.x, tv[2].point.x));
+	float minY = MIN(tv[0].point.y, MIN(tv[1].point.y, tv[2].point.y)), maxY = MAX(tv[0].point.y, MAX(tv[1].point.y, tv[2].point.y));
+	int x0 = MAX((int)ceil(minX - 0.5f), 0), x1 = MIN((int)floor(maxX + 0.5f), targetWidth - 1);
+	int y0 = MAX((int)ceil(minY - 0.5f), 0), y1 = MIN((int)floor(maxY + 0.5f), targetHeight - 1);
+	if (x0 > x1 || y0 > y1) return;
+
+	// λõıߺ
+	float edgeOffset[3][8], depthOffset[8];
+	for (int s = 0; s < samples; s++) {
+		for (int i = 0; i < 3; i++) edgeOffset[i][s] = A[i] * offsets[s].x + B[i] * offsets[s].y;
+		depthOffset[s] = perspective ? ddx.rhw * offsets[s].x + ddy.rhw * offsets[s].y : ddx.point.z * offsets[s].x + ddy.point.z * offsets[s].y;
+	}
+
+	RGBAColor c;
+	float depth[8];
+	for (int y = y0; y <= y1; y++) {
+		V v = tv[0] + ddx * (x0 - tv[0].point.x) + ddy * (y - tv[0].point.y);
+		float e0 = A[0] * x0 + B[0] * y + C[0], e1 = A[1] * x0 + B[1] * y + C[1], e2 = A[2] * x0 + B[2] * y + C[2];
+		float* depthRow = multisampleBuffer.depthRow(y);
+		frag.y = y;
+
+		for (int x = x0; x <= x1; x++, v += ddx, e0 += A[0], e1 += A[1], e2 += A[2]) {
+			// Ȳ(͸ͶӰȽrhwȽ1/z)
+			float* sampleDepth = depthRow + (size_t)x * samples;
+			float depthBase = perspective ? v.rhw : v.point.z;
+			unsigned int mask = 0;
+			for (int s = 0; s < samples; s++) {
+				if (e0 + edgeOffset[0][s] < 0 || e1 + edgeOffset[1][s] < 0 || e2 + edgeOffset[2][s] < 0) continue;
+				depth[s] = perspective ? depthBase + depthOffset[s] : 1.0f / (depthBase + depthOffset[s]);
+				if (depth[s] >= sampleDepth[s]) mask |= 1u << s;
+			}
+			if (!mask) continue;
+
+			// ʱڵһͨĲɫ, 
+			V at = v;
+			if (e0 < 0 || e1 < 0 || e2 < 0) {
+				int s = 0;
+				while (!(mask & (1u << s))) s++;
+				at = v + ddx * offsets[s].x + ddy * offsets[s].y;
+			}
+			float rhw_inv = 1.0f / at.rhw;
+			frag.x = x;
+			if constexpr (S::TEXCOORD >= 0) {
+				frag.dx = ddx.varyings.vector2(S::TEXCOORD) * rhw_inv;
+				frag.dy = ddy.varyings.vector2(S::TEXCOORD) * rhw_inv;
+			}
+			if (shader.fragment(at.varyings * rhw_inv, frag, c) &&
+				(currentBlend == Opaque || c.alpha * currentOpacity >= currentAlphaCutoff)) {
+				for (int s = 0; s < samples; s++)
+					if (mask & (1u << s)) sampleDepth[s] = depth[s];
+				multisampleBuffer.write(x, y, mask, c.rgb);
+			}
+		}
+	}
+}
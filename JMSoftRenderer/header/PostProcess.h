@@ -0,0 +1,51 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+enum ToneMapping
+{
+	LinearClamp,	// no tone curve, values above 1 clip
+	Reinhard,		// c / (1 + c) per channel
+	ACESFilmic,		// Narkowicz's fit of the ACES filmic curve
+};
+
+// Resolve of the HDR render target to the final 8 bit image, once per pixel in parallel:
+// exposure, tone curve, gamma encoding and an ordered dither against banding, 4 pixels at a time
+// with SSE. Gamma goes through a table indexed by sqrt(c), rebuilt when gamma changes.
+class ToneMapper {
+private:
+	static const int TABLE_SIZE = 1024;
+	float encodeTable[TABLE_SIZE + 2];	// 255 * (i / TABLE_SIZE)^(2 / gamma), the last entry repeats c = 1
+	float tableGamma = 0.0f;
+
+public:
+	ToneMapping mapping = LinearClamp;
+	float exposure = 1.0f;
+	float gamma = 1.0f;			// 2.2 for displays, 1 keeps the linear output
+	bool dither = true;
+
+	void apply(const ColorBuffer& hdr, IntBuffer& image);
+};
+
+// Fast approximate anti-aliasing (FXAA 3.11 quality style) on a final 8 bit RGB image.
+// Luma is computed once into a bordered scratch buffer. The image is then filtered in parallel
+// tiles, where 4 pixels at a time are tested for local contrast with SSE and only the few
+// edge pixels run the scalar edge search and blend.
+class FXAA {
+private:
+	vector<float> luma;			// (width + 2) x (height + 2), the border replicates the edge pixels
+	vector<int> source;			// unfiltered copy of the image
+	int width = 0, height = 0;
+
+	// luma at image position (x, y), bilinear and clamped to the image
+	float lumaAt(float x, float y) const;
+	// anti-aliased color of pixel (x, y) whose local contrast passed the edge test
+	int filterPixel(int x, int y) const;
+
+public:
+	float edgeThreshold = 0.166f;		// minimum contrast relative to the brightest neighbour
+	float edgeThresholdMin = 0.0833f;	// minimum contrast, skips noise in dark areas
+	float subpixelQuality = 0.75f;		// amount of sub-pixel aliasing removal, 0 to 1
+
+	void apply(IntBuffer& image);
+};
@@ -3,6 +3,7 @@
 #include "../Core/Vector.h"
 #include "../Core/Color.h"
 #include "FrameBuffer.h"
+#include "ShaderProgram.h"
 
 typedef Vector2 TexCoord;
 
@@ -13,110 +14,181 @@ struct Vertex {
 	Vector3 normal;
 };
 
-// ɫ
-typedef function<
-	bool(RGBColor& out, const Vector3& pos, const RGBColor& color, const Vector3& normal,
-		const shared_ptr<IntBuffer>& texture, const TexCoord& texCoord)
-> ShadeFunc;
+// Χ
+struct AABB {
+	Vector3 min = Vector3(Math::Infinity);
+	Vector3 max = Vector3(-Math::Infinity);
 
-// Mesh
-struct Mesh {
-	vector<Vertex> vertices;
+	inline void expand(const Vector3& p) {
+		min = Vector3(MIN(min.x, p.x), MIN(min.y, p.y), MIN(min.z, p.z));
+		max = Vector3(MAX(max.x, p.x), MAX(max.y, p.y), MAX(max.z, p.z));
+	}
+	inline bool isEmpty() const { return min.x > max.x; }
+	inline Vector3 center() const { return (min + max) * 0.5f; }
+	inline Vector3 extent() const { return (max - min) * 0.5f; }
+};
+
+struct BoundingSphere {
+	Vector3 center;
+	float radius = 0;
+};
+
+// ԼMESHLET_TRIANGLESɵĴ, ׶뱳׶޳
+struct Meshlet {
+	unsigned int firstIndex, triangleCount;
+	BoundingSphere sphere;
+	Vector3 coneAxis;	// ηߵƽ
+	float coneCutoff;	// ׶ǵsin, Ϊ1ʱ޳
+};
+const unsigned int MESHLET_TRIANGLES = 64;
+
+// ֻͼ(ڴɱ𴦳, ļӳ)
+template <class T>
+class ArrayView {
+private:
+	const T* ptr = nullptr;
+	size_t count = 0;
+
+public:
+	ArrayView() {}
+	ArrayView(const T* ptr, size_t count) : ptr(ptr), count(count) {}
+	ArrayView(const vector<T>& v) : ptr(v.data()), count(v.size()) {}
+
+	inline const T& operator[](size_t i) const { assert(i < count); return ptr[i]; }
+	inline const T* data() const { return ptr; }
+	inline size_t size() const { return count; }
+	inline bool empty() const { return count == 0; }
+	inline const T* begin() const { return ptr; }
+	inline const T* end() const { return ptr + count; }
+};
+
+// дĶ(SoA), ڹMeshGeometry
+struct MeshBuffers {
+	vector<Vector3> positions;
+	vector<Vector3> normals;
+	vector<TexCoord> texCoords;
 	vector<unsigned int> indices;
-	MipMap texture;
-	ShadeFunc shadeFunc;
-	RGBColor color;
+	vector<Meshlet> meshlets;
+};
+
+// ˳зΪMeshletΧ뷨׶
+void BuildMeshlets(MeshBuffers& buffers);
+
+// ɱļ, 㰴SoA洢Ҹͬ, ɱMesh
+struct MeshGeometry {
+	ArrayView<Vector3> positions;
+	ArrayView<Vector3> normals;
+	ArrayView<TexCoord> texCoords;
+	ArrayView<unsigned int> indices;
+	ArrayView<Meshlet> meshlets;
+	AABB bounds;
+	BoundingSphere sphere;
+	shared_ptr<const void> storage;	// ͼָڴ(MeshBuffersӳļ)
+
+	inline size_t vertexCount() const { return positions.size(); }
+	inline size_t triangleCount() const { return indices.size() / 3; }
+
+	// ӹܶݲΧ, ΧMeshlet
+	static shared_ptr<const MeshGeometry> Create(MeshBuffers&& buffers) {
+		if (buffers.meshlets.empty()) BuildMeshlets(buffers);
+		auto owned = make_shared<const MeshBuffers>(std::move(buffers));
+		auto geometry = make_shared<MeshGeometry>();
+		geometry->positions = owned->positions;
+		geometry->normals = owned->normals;
+		geometry->texCoords = owned->texCoords;
+		geometry->indices = owned->indices;
+		geometry->meshlets = owned->meshlets;
+		for (auto& p : geometry->positions) geometry->bounds.expand(p);
+		geometry->sphere.center = geometry->bounds.center();
+		for (auto& p : geometry->positions)
+			geometry->sphere.radius = MAX(geometry->sphere.radius, (p - geometry->sphere.center).length());
+		geometry->storage = owned;
+		return geometry;
+	}
 };
 
-// ͸ӽĲֵ
+// 򻯺ļμԭʼMesh(ռ)
+struct MeshLOD {
+	shared_ptr<const MeshGeometry> geometry;
+	float error = 0;
+};
+
+// еMesh: ֻƶ, ΪֻԴ
+enum BlendMode
+{
+	Opaque,
+	AlphaTest,	// alphaalphaCutoffƬԪ, ఴ͸
+	AlphaBlend	// д, ڲ͸Mesh֮Pipeline::transparencyMode
+};
+
+struct Mesh {
+	shared_ptr<const MeshGeometry> geometry;
+	vector<MeshLOD> lods;		// ϸ, geometry
+	shared_ptr<const MipMap> texture;
+	shared_ptr<const MeshShader> shader;	// Զɫ(MakeShader), ΪʱʹPipelineı׼PBRɫ
+	RGBColor color = Colors::White;
+	bool occluder = false;		// Ƿдڵ, ʺǽȴ򵥵Mesh
+	bool dynamic = false;		// ƶMeshÿ֡ػӰ, MeshӰȱ
+	BlendMode blendMode = Opaque;
+	float opacity = 1.0f;		// ɫalpha
+	float alphaCutoff = 0.5f;	// AlphaTestֵ
+
+	Mesh() {}
+	Mesh(shared_ptr<const MeshGeometry> geometry, shared_ptr<const MipMap> texture = nullptr, RGBColor color = Colors::White) :
+		geometry(std::move(geometry)), texture(std::move(texture)), color(color) {}
+	Mesh(const Mesh&) = delete;
+	Mesh& operator=(const Mesh&) = delete;
+	Mesh(Mesh&&) = default;
+	Mesh& operator=(Mesh&&) = default;
+
+	// ͬһݼ¾()
+	inline Mesh share() const {
+		Mesh mesh(geometry, texture, color);
+		mesh.lods = lods;
+		mesh.shader = shader;
+		mesh.occluder = occluder;
+		mesh.dynamic = dynamic;
+		mesh.blendMode = blendMode;
+		mesh.opacity = opacity;
+		mesh.alphaCutoff = alphaCutoff;
+		return mesh;
+	}
+};
+
+// ͸ӽĲֵ, varyingsѳrhw
+template <int N>
 struct TVertex {
 	Vector3 point;
-	Vector3 worldPos;
-	RGBColor color;
-	TexCoord texCoord;
-	Vector3 normal;
 	float rhw;// view 1/Z
+	Varyings<N> varyings;
 
-	TVertex() {}
-	TVertex(const Vertex& vertex) : color(vertex.color), texCoord(vertex.texCoord) {}
-	TVertex(const Vector3& point, const Vector3& worldPos, const RGBColor& color, TexCoord texCoord, const Vector3& normal, float rhw) :
-		point(point), worldPos(worldPos), color(color), normal(normal), rhw(rhw), texCoord(texCoord) {}
-
-	void init_rhw(float w) {
-		rhw = 1.0f / w;
-		worldPos *= rhw;
-		color *= rhw;
-		texCoord *= rhw;
-		normal *= rhw;
-	}
 	TVertex operator+ (const TVertex& vertex) const {
-		return TVertex{
-			point + vertex.point,
-			worldPos + vertex.worldPos,
-			color + vertex.color,
-			texCoord + vertex.texCoord,
-			normal + vertex.normal,
-			rhw + vertex.rhw
-		};
+		return TVertex{ point + vertex.point, rhw + vertex.rhw, varyings + vertex.varyings };
 	}
 	TVertex& operator+= (const TVertex& vertex) {
 		point += vertex.point;
-		worldPos += vertex.worldPos;
-		color += vertex.color;
-		texCoord += vertex.texCoord;
-		normal += vertex.normal;
 		rhw += vertex.rhw;
+		varyings += vertex.varyings;
 		return *this;
 	}
 	TVertex operator- (const TVertex& vertex) const {
-		return TVertex{
-			point - vertex.point,
-			worldPos - vertex.worldPos,
-			color - vertex.color,
-			texCoord - vertex.texCoord,
-			normal - vertex.normal,
-			rhw - vertex.rhw,
-		};
-	}
-	TVertex& operator-= (const TVertex& vertex) {
-		point -= vertex.point;
-		worldPos -= vertex.worldPos;
-		color -= vertex.color;
-		texCoord -= vertex.texCoord;
-		normal -= vertex.normal;
-		rhw -= vertex.rhw;
-		return *this;
+		return TVertex{ point - vertex.point, rhw - vertex.rhw, varyings - vertex.varyings };
 	}
 	TVertex operator* (float k) const {
-		return TVertex{
-			point * k,
-			worldPos * k,
-			color * k,
-			texCoord * k,
-			normal * k,
-			rhw * k,
-		};
-	}
-	TVertex& operator*= (float k) {
-		point *= k;
-		worldPos *= k;
-		color *= k;
-		texCoord *= k;
-		normal *= k;
-		rhw *= k;
-		return *this;
+		return TVertex{ point * k, rhw * k, varyings * k };
 	}
-
 };
 
 // ɨ()
+template <class V>
 struct Scanline {
-	TVertex v0, step;
+	V v0, step;
 	int x0, x1, y;
 	Vector2 dx, dy;
 };
 
 // и
+template <class V>
 struct SplitedTriangle {
 	// и
 	// 00: 01:ƽ 10:ƽ 11:ƽ+ƽ
@@ -127,8 +199,8 @@ struct SplitedTriangle {
 		FLAT_TOP_BOTTOM
 	};
 
-	TVertex top;
-	TVertex left, right;
-	TVertex bottom;
+	V top;
+	V left, right;
+	V bottom;
 	TriangleType type;
 };
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "FrameBuffer.h"
+#include "DirtyTiles.h"
+
+// Progressive rendering for interactive navigation. While anything in the scene changes, frames are
+// rendered at half the output resolution per axis (a quarter of the pixels) and upsampled. Once the
+// scene holds still, the image is refined to full resolution a few DirtyTiles tiles per frame,
+// nearest to the screen center first, keeping the tiles already refined since the last change.
+class ProgressiveRefiner {
+private:
+	shared_ptr<ColorBuffer> image;		// output: upsampled preview, partly replaced by refined tiles
+	vector<int> order;					// tile indices (row major) by distance from the screen center
+	size_t width = 0, height = 0;		// output size
+	int tilesX = 0;
+	size_t refined = 0, batch = 0;		// order[refined - batch, refined) are the tiles of this frame
+
+public:
+	int tilesPerFrame = 64;				// full resolution tiles rendered per frame while refining
+
+	// output size, reallocates only when it changes
+	void resize(size_t width, size_t height);
+	// start over from a preview frame
+	inline void restart() { refined = batch = 0; }
+	inline bool isComplete() const { return refined == order.size(); }
+
+	// size of the reduced resolution target of preview frames
+	inline int get_renderWidth() const { return (int)(width + 1) / 2; }
+	inline int get_renderHeight() const { return (int)(height + 1) / 2; }
+
+	// Pick the next tiles to refine and select them as the dirty tiles of tiles (of the output size)
+	void selectNextTiles(DirtyTiles& tiles);
+
+	// bilinear upsample of a preview frame in the top left corner of color to the output
+	void upsample(const ColorBuffer& color);
+	// copy the tiles selected this frame from the full resolution color to the output
+	void copyTiles(const ColorBuffer& color);
+	inline const ColorBuffer& get_image() const { return *image; }
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "BVH.h"
+#include "Scene.h"
+
+// Ray traced rendering of a Scene into an HDR color buffer, as an alternative to the rasterizer
+// for reference stills. Camera rays are traced in 2x2 pixel packets through a BVH over the
+// triangles of every mesh instance (finest LOD, rebuilt when geometry or transforms change),
+// and shaded with the material model of the standard shader (Shader::PhysicallyBasedShading with
+// the pipeline's roughness and metallic): the directional light and every point and spot light
+// behind a shadow ray, and the environment lighting scaled by ray traced ambient occlusion.
+// All meshes are treated as opaque, custom mesh shaders are not run.
+class RayTracer {
+public:
+	int samplesPerPixel = 1;	// camera rays per pixel, jittered within the pixel when more than 1
+	int aoSamples = 8;			// ambient occlusion rays per camera ray, 0 to disable
+	float aoDistance = 0.5f;	// world space reach of the ambient occlusion rays
+
+private:
+	// a mesh instance, whose triangles start at firstTriangle in the BVH build order
+	struct Object {
+		const Mesh* mesh;
+		Matrix world;
+		RGBColor color;			// mesh color * instance color
+		unsigned int firstTriangle;
+	};
+	vector<Object> objects;
+	vector<Vector3> vertices;	// world space triangle corners of the last build
+	BVH bvh;
+	unsigned long long buildKey = 0;	// hash of the geometry and transforms of the last build
+
+	struct Surface;
+	struct Frame;
+	// shade the hits of a camera ray packet, adding weight * radiance to colors
+	void shadePacket(const Frame& frame, const RayPacket& packet, int pixelX, int pixelY, int sample, RGBColor* colors, float weight) const;
+
+public:
+	// rebuild the BVH if any mesh geometry or instance transform changed since the last call
+	void update(const Scene& scene);
+	inline const BVH& get_bvh() const { return bvh; }
+
+	// Trace the scene from its camera into target (the size of the image), background where
+	// camera rays miss. Calls update() first.
+	void render(const Scene& scene, ColorBuffer& target, const RGBColor& background,
+		float roughness, float metallic, int mipLevelOffset, bool shadows);
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "../Core/Matrix.h"
+#include "Environment.h"
 
 struct Triangle
 {
@@ -14,18 +15,78 @@ struct DirLight
 	RGBColor color;
 };
 
+enum LightType
+{
+	PointLight,
+	SpotLight
+};
+
+// Դ۹, range˥0
+struct PunctualLight
+{
+	LightType type = PointLight;
+	Vector3 position;
+	Vector3 dir;				// ۹Ƶ䷽
+	float range = 1;
+	float cosInner = 1, cosOuter = 0;	// ۹׶ǵ
+	float intensity = 1;
+	RGBColor color = Colors::White;
+
+	// Χ, ۹ȡסԲ׶С
+	void bounds(Vector3& center, float& radius) const {
+		if (type == SpotLight && cosOuter > 0.7071f) {
+			radius = range * 0.5f / (cosOuter * cosOuter);
+			center = position + dir * radius;
+		}
+		else {
+			center = position;
+			radius = range;
+		}
+	}
+
+	// LΪָԴĵλ, distanceΪԴľ
+	float attenuation(const Vector3& L, float distance) const {
+		// ƽ˥, (1 - (d/r)^4)^2ƽضϵrange
+		float window = Math::clamp(1.0f - Math::pow4(distance / range));
+		float atten = window * window / (distance * distance + 1e-4f);
+		if (type == SpotLight) {
+			float cosAngle = -L.dot(dir);
+			atten *= Math::smoothStep(cosOuter, cosInner, cosAngle);
+		}
+		return atten;
+	}
+};
+
+// ʵ: ģ;ɫ(Meshɫ)
+struct Instance
+{
+	Matrix model;
+	RGBColor color = Colors::White;
+};
+
+// һMesh, ʵ
+struct InstancedMesh
+{
+	Mesh mesh;
+	vector<Instance> instances;
+};
+
 class Scene {
 	friend class Pipeline;
+	friend class RayTracer;
 
 private:
 	Matrix model;
 	Matrix view;// Ŀǰõ׼ȷ
 	Matrix projection;
 
-	Matrix view_light, projection_light;
+	Matrix view_light, projection_light;// Ӱֻʹview_lightĳ, ͶӰΧPipeline
 	DirLight dirLight;
+	vector<PunctualLight> lights;// Դ۹, Ļִ޳ɫ
+	shared_ptr<Environment> environment;// (IBL), Ϊûл
 
-	vector<Mesh> meshes;
+	vector<InstancedMesh> meshes;
+	unsigned int staticVersion = 0;// ̬Meshʵıʱ, ʹľ̬ӰʧЧ
 
 public:
 	Scene() {}
@@ -52,12 +113,52 @@ public:
 		dirLight.intensity = intensity;
 	}
 
+	void addPointLight(Vector3 pos, float range, float intensity, RGBColor color) {
+		PunctualLight light;
+		light.type = PointLight;
+		light.position = pos;
+		light.range = range;
+		light.intensity = intensity;
+		light.color = color;
+		lights.push_back(light);
+	}
+	// innerAngle, outerAngleΪ׶()
+	void addSpotLight(Vector3 pos, Vector3 dir, float range, float innerAngle, float outerAngle, float intensity, RGBColor color) {
+		PunctualLight light;
+		light.type = SpotLight;
+		light.position = pos;
+		light.dir = dir.normalize();
+		light.range = range;
+		light.cosInner = cos(innerAngle * Math::DEGREE_TO_RADIUS);
+		light.cosOuter = cos(outerAngle * Math::DEGREE_TO_RADIUS);
+		light.intensity = intensity;
+		light.color = color;
+		lights.push_back(light);
+	}
+	void clearLights() { lights.clear(); }
+	// LoadEnvironmentصĻ, intensityΪ
+	void setEnvironment(shared_ptr<Environment> environment, float intensity = 1.0f) {
+		this->environment = environment;
+		if (environment) environment->intensity = intensity;
+	}
 
 	void cameraTranslate(float y, float z) { this->view.translate(0, y, z); }
 	void modelRotate(float angle) { this->model.rotate(0, 1, 0, angle); }
 
-	void addMesh(Mesh mesh) {
-		meshes.push_back(mesh);
+	// Mesh, setInstancesʹ
+	size_t addMesh(Mesh&& mesh) {
+		return addInstances(std::move(mesh), { Instance() });
+	}
+	// ͬһMeshĶʵ, ߰任Mesh
+	size_t addInstances(Mesh&& mesh, vector<Instance> instances) {
+		if (!mesh.dynamic) staticVersion++;
+		meshes.push_back({ std::move(mesh), std::move(instances) });
+		return meshes.size() - 1;
+	}
+	// 滻һMeshȫʵ, ƶӦΪMesh::dynamic
+	void setInstances(size_t index, vector<Instance> instances) {
+		if (!meshes[index].mesh.dynamic) staticVersion++;
+		meshes[index].instances = std::move(instances);
 	}
 
 	void addTriangle(float offset = -0.1f) {
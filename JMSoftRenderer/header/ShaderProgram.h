@@ -0,0 +1,130 @@
+#pragma once
+
+#include "../Core/Vector.h"
+#include "../Core/Color.h"
+#include "FrameBuffer.h"
+
+#include <utility>
+#include <xmmintrin.h>
+
+class Pipeline;
+struct MeshGeometry;
+
+// N floats written by the vertex stage and interpolated (perspective correct) for the fragment stage.
+// Packed into whole SSE registers, the unused tail lanes stay zero.
+template <int N>
+struct Varyings {
+	static const int PACKED = (N + 3) / 4 * 4;
+	alignas(16) float data[PACKED];
+
+	Varyings() { for (int i = N; i < PACKED; i++) data[i] = 0; }
+
+	inline float& operator[](int i) { return data[i]; }
+	inline float operator[](int i) const { return data[i]; }
+
+	inline Vector2 vector2(int i) const { return Vector2(data[i], data[i + 1]); }
+	inline Vector3 vector3(int i) const { return Vector3(data[i], data[i + 1], data[i + 2]); }
+	inline RGBColor color(int i) const { return RGBColor(data[i], data[i + 1], data[i + 2]); }
+	inline void set(int i, const Vector2& v) { data[i] = v.x, data[i + 1] = v.y; }
+	inline void set(int i, const Vector3& v) { data[i] = v.x, data[i + 1] = v.y, data[i + 2] = v.z; }
+	inline void set(int i, const RGBColor& c) { data[i] = c.r, data[i + 1] = c.g, data[i + 2] = c.b; }
+
+	inline Varyings operator+(const Varyings& v) const { Varyings r; each([&](int i) { r.store(i, _mm_add_ps(load(i), v.load(i))); }); return r; }
+	inline Varyings operator-(const Varyings& v) const { Varyings r; each([&](int i) { r.store(i, _mm_sub_ps(load(i), v.load(i))); }); return r; }
+	inline Varyings operator*(float k) const {
+		Varyings r;
+		__m128 k4 = _mm_set1_ps(k);
+		each([&](int i) { r.store(i, _mm_mul_ps(load(i), k4)); });
+		return r;
+	}
+	inline Varyings& operator+=(const Varyings& v) { each([&](int i) { store(i, _mm_add_ps(load(i), v.load(i))); }); return *this; }
+
+private:
+	inline __m128 load(int i) const { return _mm_load_ps(data + i); }
+	inline void store(int i, __m128 v) { _mm_store_ps(data + i, v); }
+
+	// f(0), f(4) ... for every register, unrolled at compile time since the interpolation runs per pixel
+	template <class F, int... I>
+	static inline void each(F f, std::integer_sequence<int, I...>) { (f(I * 4), ...); }
+	template <class F>
+	static inline void each(F f) { each(f, std::make_integer_sequence<int, PACKED / 4>()); }
+};
+
+// Inputs of the vertex stage, read from the pipeline's transformed vertex caches
+struct VertexInput {
+	const Vector3& worldPos;
+	const Vector3& normal;		// world space, not normalized
+	const Vector2& texCoord;
+	const RGBColor& color;		// mesh color * instance color, also FragmentInput::color
+};
+
+// Per pixel inputs of the fragment stage besides the varyings
+struct FragmentInput {
+	int x, y;					// pixel coordinates
+	Vector2 dx, dy;				// screen space derivatives of the TEXCOORD varyings
+	RGBColor color;				// mesh color * instance color, constant over a triangle
+	const MipMap* texture;		// texture of the mesh, may be null
+	int mipLevelOffset;
+
+	// trilinear sample of the mesh texture, white without one
+	inline RGBColor sample(const Vector2& uv) const {
+		return texture && !texture->isEmpty() ? texture->SampleMipmap(uv, dx, dy, mipLevelOffset) : Colors::White;
+	}
+};
+
+// A shader is a plain functor type, the pipeline instantiates its triangle setup and scanline
+// loops for every shader so both stages are inlined and only the declared varyings are interpolated:
+//
+//	struct MyShader {
+//		static const int VARYINGS = 5;		// number of interpolated floats
+//		static const int TEXCOORD = 3;		// first of the two varyings used for mip selection, -1 for none
+//		void vertex(const VertexInput& in, Varyings<VARYINGS>& out) const;
+//		bool fragment(const Varyings<VARYINGS>& in, const FragmentInput& frag, RGBAColor& out) const;	// false discards
+//	};
+//
+// The alpha of out is multiplied by Mesh::opacity and only used by alpha tested and blended meshes.
+//
+// Meshes hold their shader type erased, with one virtual call per instance batch.
+class MeshShader {
+public:
+	virtual ~MeshShader() {}
+	// shade and rasterize the visible meshlets of the pipeline's current instance batch
+	virtual void draw(Pipeline& pipeline, const MeshGeometry& geometry) const = 0;
+};
+
+template <class S>
+class ShaderProgram : public MeshShader {
+public:
+	S shader;
+
+	ShaderProgram(const S& shader) : shader(shader) {}
+	void draw(Pipeline& pipeline, const MeshGeometry& geometry) const override;	// defined in Pipeline.h
+};
+
+template <class S>
+inline shared_ptr<const MeshShader> MakeShader(const S& shader) { return make_shared<ShaderProgram<S>>(shader); }
+
+// Texture * mesh color, no lighting
+struct UnlitShader {
+	static const int VARYINGS = 2;
+	static const int TEXCOORD = 0;
+
+	inline void vertex(const VertexInput& in, Varyings<VARYINGS>& out) const { out.set(0, in.texCoord); }
+	inline bool fragment(const Varyings<VARYINGS>& in, const FragmentInput& frag, RGBAColor& out) const {
+		out = frag.color * frag.sample(in.vector2(0));
+		return true;
+	}
+};
+
+// World space normal mapped to [0, 1]
+struct NormalShader {
+	static const int VARYINGS = 3;
+	static const int TEXCOORD = -1;
+
+	inline void vertex(const VertexInput& in, Varyings<VARYINGS>& out) const { out.set(0, in.normal); }
+	inline bool fragment(const Varyings<VARYINGS>& in, const FragmentInput&, RGBAColor& out) const {
+		Vector3 n = in.vector3(0).normalize();
+		out = RGBColor(n.x * 0.5f + 0.5f, n.y * 0.5f + 0.5f, n.z * 0.5f + 0.5f);
+		return true;
+	}
+};
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+// Per tile shading rates for variable rate shading. Each frame the rates are derived from the
+// luminance of the finished previous frame: where neighboring pixels of a tile differ little, the
+// pipeline shades once per 2x2 or 4x4 block and reuses the color for the whole block (depth stays
+// per pixel). Rates lag one frame behind, so fast motion can leave a coarse tile for a frame.
+class ShadingRateImage {
+public:
+	static const int TILE_SIZE = 16;	// pixels, a multiple of the coarsest block size
+
+private:
+	vector<unsigned char> rates;		// 1, 2 or 4 per tile, row major
+	int width = 0, height = 0, tilesX = 0, tilesY = 0;
+
+	// per thread rows of update(): largest step per tile, luminance of the current and previous pixel row
+	struct Scratch { vector<int> steps, luma, above; };
+	vector<Scratch> scratch;
+
+public:
+	// size of the render target, every tile is back at full rate when it changes. Call before update().
+	void resize(int width, int height);
+
+	// Rates from the 8 bit image of the previous frame (of the same size): the coarsest block whose
+	// size times the largest luminance step between neighboring pixels of the tile stays within
+	// maxError (0 to 1). Larger values shade less often and blur more.
+	void update(const IntBuffer& image, float maxError);
+
+	// rates of the tiles in pixel row y
+	inline const unsigned char* row(int y) const { return &rates[(y / TILE_SIZE) * tilesX]; }
+};
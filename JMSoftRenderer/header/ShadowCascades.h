@@ -0,0 +1,88 @@
+#pragma once
+
+#include "../Core/Matrix.h"
+#include "FrameBuffer.h"
+
+enum ShadowFilter
+{
+	Hard,	// single depth compare
+	PCF,	// rotated Poisson disk percentage closer filtering
+	PCSS,	// blocker search, then PCF sized by the estimated penumbra
+	VSM,	// Chebyshev bound on blurred (z, z^2) moments
+	ESM		// blurred exp(c * z)
+};
+
+struct ShadowFilterSettings {
+	ShadowFilter filter = PCF;
+	float radius = 1.5f;			// PCF kernel radius in texels
+	float lightSize = 0.02f;		// PCSS: tangent of the light's angular radius
+	int blurRadius = 2;				// VSM/ESM moment box blur radius in texels
+	float vsmBleedReduction = 0.2f;	// VSM: cut off this much of the Chebyshev bound
+	float esmExponent = 80.0f;		// ESM: sharpness c, exp(c) must stay within float range
+};
+
+// One orthographic shadow map covering a depth slice of the camera frustum
+struct ShadowCascade {
+	shared_ptr<FloatBuffer> depth;	// light clip space z, 1 is empty
+	shared_ptr<FrameBuffer<Vector2>> moments;	// VSM (z, z^2) or ESM (exp(c * z), 0), blurred
+	Matrix view, projection, viewProjection;
+	float splitDepth = 0;			// camera view depth where this cascade ends
+	float texelSize = 0;			// world space size of one shadow texel
+	float depthRange = 0;			// world space extent of light clip z [0, 1]
+	float depthBias = 0;			// two texels of slope in light clip space z
+
+	// static caster cache
+	shared_ptr<FloatBuffer> staticDepth;	// depth of the static casters alone
+	Matrix staticMatrix;			// model * viewProjection staticDepth was rendered with
+	unsigned int staticVersion = 0;	// scene static content staticDepth was rendered from
+	bool staticValid = false;
+	bool dynamicDrawn = false;		// depth also holds dynamic casters
+	bool dirty = true;				// depth changed since the moment map was built
+};
+
+// Cascaded shadow maps for a directional light. Splits blend logarithmic and uniform
+// distribution, every slice is enclosed by a sphere (so the map size does not change as
+// the camera turns) and the map origin is snapped to whole texels to avoid shimmering.
+class ShadowCascades {
+private:
+	vector<ShadowCascade> cascades;
+	vector<Vector2> blurRows;	// horizontally blurred moments between the two prefilter passes
+	vector<vector<Vector2>> momentRows;	// per thread copy of the row being blurred
+	ShadowFilterSettings prefiltered;	// settings the current moment maps were built with
+
+public:
+	ShadowCascades(const vector<size_t>& resolutions) { setResolutions(resolutions); }
+
+	inline size_t size() const { return cascades.size(); }
+	inline const ShadowCascade& operator[](size_t i) const { return cascades[i]; }
+
+	// one cascade per entry, each with its own square map resolution
+	void setResolutions(const vector<size_t>& resolutions);
+	// clear every map and drop the static caster cache
+	void clear();
+
+	// Start a cascade from its cached static caster depth. Returns false, with the map cleared,
+	// if the cache was rendered with other matrices or scene content; the static casters must
+	// then be drawn again and stored with storeStatic().
+	bool restoreStatic(size_t index, const Matrix& modelViewProjection, unsigned int staticVersion);
+	void storeStatic(size_t index, const Matrix& modelViewProjection, unsigned int staticVersion);
+	// dynamic casters are about to be drawn on top of the static depth
+	void beginDynamic(size_t index);
+
+	// Fit the cascades to the camera frustum from its near plane to shadowDistance.
+	// lightView orients the light, casterMinZ is the light view z nearest to the light
+	// of any shadow caster, so casters outside a slice still land in its map.
+	void fit(const Matrix& view, const Matrix& projection, float shadowDistance,
+		float splitLambda, const Matrix& lightView, float casterMinZ);
+
+	// cascade covering a camera view depth, -1 beyond the last split
+	int select(float viewDepth) const;
+
+	// build the blurred moment maps VSM and ESM sample, after the depth maps are rendered.
+	// Cascades whose depth did not change keep their moments.
+	void prefilter(const ShadowFilterSettings& settings);
+
+	// Lit fraction of a light clip space position (x, y in texels, z in [0, 1]) in a cascade.
+	// pixelX, pixelY pick the kernel rotation, so neighbouring pixels sample different taps.
+	float sample(int index, const Vector3& position, const ShadowFilterSettings& settings, int pixelX, int pixelY) const;
+};
@@ -0,0 +1,15 @@
+#pragma once
+
+#include "Primitives.h"
+
+// Quadric error metric simplification by half-edge collapses: a vertex is merged into
+// one of its neighbours, so surviving vertices keep their original uv and normal.
+// Vertices on open or seam edges never move. Stops at targetTriangles or once the next
+// collapse would exceed maxError (object space distance); error receives the largest
+// error actually introduced.
+shared_ptr<const MeshGeometry> SimplifyMesh(const MeshGeometry& geometry, size_t targetTriangles,
+	float maxError = Math::Infinity, float* error = nullptr);
+
+// Append up to levels coarser LODs to mesh.lods, each with about half the triangles
+// of the previous one. Stops early when the mesh cannot be reduced further.
+void GenerateLODs(Mesh& mesh, int levels);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "../Core/Matrix.h"
+#include "FrameBuffer.h"
+
+// Temporal upsampling for interactive preview. Every frame is rendered at half the output
+// resolution per axis, with the projection jittered so that the samples land on one of the 4
+// output pixels of each 2x2 block, cycling through all of them in 4 frames. resolve() builds the
+// full resolution image from the new samples and the previous output, reprojected per pixel from
+// the new depth and the change of the (unjittered) MVP matrix. The reprojected history is clamped
+// to the color range of the surrounding new samples, which rejects most stale colors from
+// disocclusions and from objects moving on their own.
+class TemporalUpsampler {
+private:
+	shared_ptr<ColorBuffer> history;	// output of the previous frame
+	shared_ptr<ColorBuffer> output;
+	shared_ptr<ColorBuffer> rangeMin, rangeMax;	// per new sample, the color range of its 3x3 neighborhood
+	Matrix previousMVP;
+	size_t width = 0, height = 0;		// output size
+	int frame = 0;
+	bool valid = false;					// history holds a frame of the current size
+
+public:
+	float sampleWeight = 0.5f;			// weight of a new sample against the history of its pixel
+
+	// output size, reallocates only when it changes
+	void resize(size_t width, size_t height);
+	// drop the history, e.g. after a cut
+	inline void invalidate() { valid = false; }
+
+	// size of the reduced resolution target
+	inline int get_renderWidth() const { return (int)(width + 1) / 2; }
+	inline int get_renderHeight() const { return (int)(height + 1) / 2; }
+	// offset (0 or 1 per axis) of this frame's samples within the 2x2 blocks of output pixels
+	void jitter(int& offsetX, int& offsetY) const;
+	// projection for this frame: pixel (X, Y) of the reduced target samples output pixel (2X + offsetX, 2Y + offsetY)
+	Matrix jitteredProjection(const Matrix& projection) const;
+
+	// Upsample the reduced resolution image in the top left corner of color and depth (the main
+	// Z buffer: rhw, or 1 / z for orthographic projections, 0 where nothing was drawn) to the output.
+	// mvp and projection are the unjittered matrices of the frame. Advances to the next jitter offset.
+	void resolve(const ColorBuffer& color, const FloatBuffer& depth, const Matrix& mvp, const Matrix& projection);
+	inline const ColorBuffer& get_output() const { return *output; }
+};
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "FrameBuffer.h"
+
+// Weighted blended order independent transparency (McGuire and Bavoil 2013). Every transparent
+// fragment adds its color and alpha times a depth based weight to accumulation targets and
+// multiplies the revealage (the product of 1 - alpha). Both are commutative, so fragments may
+// arrive in any order; composite() puts the weighted average color over the opaque image.
+class WeightedBlendedOIT {
+private:
+	shared_ptr<ColorBuffer> accumColor;	// sum of color * alpha * weight
+	shared_ptr<FloatBuffer> accumAlpha;	// sum of alpha * weight
+	shared_ptr<FloatBuffer> revealage;	// product of 1 - alpha, 1 where nothing was drawn
+	size_t width = 0, height = 0;
+
+public:
+	// reallocates only when the size changes
+	void resize(size_t width, size_t height);
+	void clear();
+
+	// depth is the view space depth of the fragment, alpha in [0, 1]
+	inline void add(int x, int y, const RGBColor& color, float alpha, float depth) {
+		// equation 7 of the paper, near fragments outweigh far ones
+		float d5 = depth * (1.0f / 5), d200 = depth * (1.0f / 200), d200_2 = d200 * d200;
+		float weight = alpha * Math::clamp(10.0f / (1e-5f + d5 * d5 + d200_2 * d200_2 * d200_2), 1e-2f, 3e3f);
+		size_t i = (size_t)y * width + x;
+		*(*accumColor)(i) += color * weight;
+		*(*accumAlpha)(i) += weight;
+		*(*revealage)(i) *= 1 - alpha;
+	}
+
+	// blend the accumulated transparent surfaces over the top left corner of target (at least as large)
+	void composite(ColorBuffer& target) const;
+};